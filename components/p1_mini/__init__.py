@@ -1,13 +1,55 @@
+import re
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import uart
 from esphome.components import binary_sensor
-from esphome.const import CONF_ID, CONF_TRIGGER_ID
+from esphome.components import sensor
+from esphome.components import text_sensor
+from esphome.components import time
+from esphome.components import web_server_base
+from esphome.components.web_server_base import CONF_WEB_SERVER_BASE_ID
+from esphome.const import (
+    CONF_ID,
+    CONF_PATH,
+    CONF_PORT,
+    CONF_RESOLUTION,
+    CONF_SIZE,
+    CONF_TIME_ID,
+    CONF_TRIGGER_ID,
+    CONF_UPDATE_INTERVAL,
+    DEVICE_CLASS_POWER,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_BYTES,
+    UNIT_KILOWATT,
+    UNIT_KILOWATT_HOURS,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
+)
 from esphome import automation
+from esphome.core import CORE
 
 DEPENDENCIES = ['uart']
+
+
+def AUTO_LOAD():
+    # The socket component is only needed, and only builds, for the TCP server, which also
+    # waits for the network to be up. This is called before the configuration is validated,
+    # so it looks at the configuration as written.
+    configs = CORE.raw_config.get('p1_mini', []) if CORE.raw_config else []
+    if not isinstance(configs, list):
+        configs = [configs]
+    if any(isinstance(config, dict) and CONF_TCP_SERVER in config for config in configs):
+        return ['sensor', 'text_sensor', 'socket', 'network']
+    return ['sensor', 'text_sensor']
+
 p1_mini_ns = cg.esphome_ns.namespace('p1_mini')
 P1Mini = p1_mini_ns.class_('P1Mini', cg.Component, uart.UARTDevice)
+P1MiniAggregator = p1_mini_ns.class_('P1MiniAggregator')
+P1MiniTcpServer = p1_mini_ns.class_('P1MiniTcpServer')
+P1MiniHistory = p1_mini_ns.class_('P1MiniHistory')
 MULTI_CONF = True
 
 CONF_P1_MINI_ID = "p1_mini_id"
@@ -16,6 +58,27 @@ CONF_IDENTIFIER = "identifier"
 CONF_MINIMUM_PERIOD = "minimum_period"
 CONF_BUFFER_SIZE = "buffer_size"
 CONF_SECONDARY_RTS = "secondary_rts"
+CONF_SECONDARY_REPLAY = "secondary_replay"
+CONF_STREAMING = "streaming"
+CONF_FAST_RESYNC = "fast_resync"
+CONF_PUBLISH_BUDGET = "publish_budget"
+CONF_READER_TASK = "reader_task"
+CONF_TCP_SERVER = "tcp_server"
+CONF_HISTORY = "history"
+CONF_SNAPSHOT = "snapshot"
+CONF_PUBLISH_SENSORS = "publish_sensors"
+CONF_ADAPTIVE_PERIOD = "adaptive_period"
+CONF_MAXIMUM_PERIOD = "maximum_period"
+CONF_THRESHOLD = "threshold"
+CONF_HYSTERESIS = "hysteresis"
+CONF_OBIS_CODES = "obis_codes"
+CONF_MAX_CLIENTS = "max_clients"
+CONF_DIAGNOSTICS = "diagnostics"
+CONF_AGGREGATES = "aggregates"
+CONF_POWER_OBIS_CODE = "power_obis_code"
+CONF_IMPORT_OBIS_CODE = "import_obis_code"
+CONF_EXPORT_OBIS_CODE = "export_obis_code"
+CONF_PEAKS = "peaks"
 CONF_ON_READY_TO_RECEIVE = "on_ready_to_receive"
 CONF_ON_RECEIVING_UPDATE = "on_receiving_update"
 CONF_ON_UPDATE_RECEIVED = "on_update_received"
@@ -23,6 +86,182 @@ CONF_ON_UPDATE_PROCESSED = "on_update_processed"
 CONF_ON_COMMUNICATION_ERROR = "on_communication_error"
 
 
+OBIS_CODE_REGEX = re.compile(r"^(\d+)\D(\d+)\D(\d+)$")
+
+def obis_code(value):
+    value = cv.string(value)
+    match = OBIS_CODE_REGEX.match(value)
+    if match is None:
+        raise cv.Invalid(f"{value} is not a valid OBIS code")
+    # The limits of the packing below, and of the parser, which would otherwise match
+    # the code to the sensor of another one
+    major, minor, micro = (int(x) for x in match.groups())
+    if major > 999 or minor > 255 or micro > 255:
+        raise cv.Invalid(f"{value} is not a valid OBIS code, the parts can be at most 999.255.255")
+    return value
+
+def packed_obis_code(value):
+    # Same packing as OBIS() in p1_mini.cpp, done here so the sensors are created with
+    # the value the parser compares against.
+    major, minor, micro = (int(x) for x in OBIS_CODE_REGEX.match(value).groups())
+    return (major & 0xfff) << 16 | (minor & 0xff) << 8 | (micro & 0xff)
+
+def identifier(value):
+    value = cv.string(value)
+    if not value:
+        raise cv.Invalid("The identifier can not be empty")
+    return value
+
+def diagnostic_sensor_schema(unit, accuracy_decimals, state_class=STATE_CLASS_MEASUREMENT):
+    return sensor.sensor_schema(
+        unit_of_measurement=unit,
+        accuracy_decimals=accuracy_decimals,
+        state_class=state_class,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    )
+
+# Each of these has a corresponding set_<name>_sensor() in P1Mini
+DIAGNOSTIC_SENSORS = {
+    "identifying_time": diagnostic_sensor_schema(UNIT_MILLISECOND, 0),
+    "message_time": diagnostic_sensor_schema(UNIT_MILLISECOND, 0),
+    "processing_time": diagnostic_sensor_schema(UNIT_MILLISECOND, 0),
+    "publishing_time": diagnostic_sensor_schema(UNIT_MILLISECOND, 0),
+    "message_loops": diagnostic_sensor_schema(None, 0),
+    "processing_loops": diagnostic_sensor_schema(None, 0),
+    "publishing_loops": diagnostic_sensor_schema(None, 0),
+    "message_size": diagnostic_sensor_schema(UNIT_BYTES, 0),
+    "predicted_lines": diagnostic_sensor_schema(UNIT_PERCENT, 0),
+    "longest_loop": diagnostic_sensor_schema(UNIT_MILLISECOND, 1),
+    "messages_per_minute": diagnostic_sensor_schema(None, 1),
+    "crc_errors": diagnostic_sensor_schema(None, 0, STATE_CLASS_TOTAL_INCREASING),
+    "buffer_overruns": diagnostic_sensor_schema(None, 0, STATE_CLASS_TOTAL_INCREASING),
+    "format_errors": diagnostic_sensor_schema(None, 0, STATE_CLASS_TOTAL_INCREASING),
+    "timeouts": diagnostic_sensor_schema(None, 0, STATE_CLASS_TOTAL_INCREASING),
+    "unrequested_data": diagnostic_sensor_schema(None, 0, STATE_CLASS_TOTAL_INCREASING),
+    "buffer_size": diagnostic_sensor_schema(UNIT_BYTES, 0),
+    "buffer_high_water_mark": diagnostic_sensor_schema(UNIT_BYTES, 0),
+    "request_period": diagnostic_sensor_schema(UNIT_MILLISECOND, 0),
+    "lost_messages": diagnostic_sensor_schema(None, 0, STATE_CLASS_TOTAL_INCREASING),
+    "recovery_time": diagnostic_sensor_schema(UNIT_MILLISECOND, 0),
+    "scheduling_delay": diagnostic_sensor_schema(UNIT_MILLISECOND, 0),
+    "uart_backlog": diagnostic_sensor_schema(UNIT_BYTES, 0),
+}
+
+DIAGNOSTICS_SCHEMA = cv.Schema({
+    cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+    **{cv.Optional(name): schema for name, schema in DIAGNOSTIC_SENSORS.items()},
+})
+
+def power_sensor_schema():
+    return sensor.sensor_schema(
+        unit_of_measurement=UNIT_KILOWATT,
+        accuracy_decimals=3,
+        device_class=DEVICE_CLASS_POWER,
+        state_class=STATE_CLASS_MEASUREMENT,
+    )
+
+def energy_sensor_schema():
+    return sensor.sensor_schema(
+        unit_of_measurement=UNIT_KILOWATT_HOURS,
+        accuracy_decimals=3,
+        state_class=STATE_CLASS_MEASUREMENT,
+    )
+
+# Each of these has a corresponding set_<name>_sensor() in P1MiniAggregator
+AGGREGATE_SENSORS = {
+    "average_power_15min": power_sensor_schema(),
+    "average_power_hour": power_sensor_schema(),
+    "hourly_peak": power_sensor_schema(),
+    "hourly_peaks_average": power_sensor_schema(),
+    "import_energy_15min": energy_sensor_schema(),
+    "import_energy_hour": energy_sensor_schema(),
+    "export_energy_15min": energy_sensor_schema(),
+    "export_energy_hour": energy_sensor_schema(),
+}
+
+AGGREGATES_SCHEMA = cv.Schema({
+    cv.GenerateID(): cv.declare_id(P1MiniAggregator),
+    cv.Optional(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
+    cv.Optional(CONF_POWER_OBIS_CODE, default="1.7.0"): obis_code,
+    cv.Optional(CONF_IMPORT_OBIS_CODE, default="1.8.0"): obis_code,
+    cv.Optional(CONF_EXPORT_OBIS_CODE, default="2.8.0"): obis_code,
+    cv.Optional(CONF_PEAKS, default=3): cv.int_range(min=1, max=5),
+    **{cv.Optional(name): schema for name, schema in AGGREGATE_SENSORS.items()},
+})
+
+ADAPTIVE_PERIOD_SCHEMA = cv.Schema({
+    cv.Required(CONF_MAXIMUM_PERIOD): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_THRESHOLD, default=0.1): cv.positive_float,
+    cv.Optional(CONF_HYSTERESIS, default=0.05): cv.positive_float,
+    # Power per phase and in total, for both directions
+    cv.Optional(CONF_OBIS_CODES, default=["1.7.0", "2.7.0", "21.7.0", "41.7.0", "61.7.0", "22.7.0", "42.7.0", "62.7.0"]): cv.ensure_list(obis_code),
+})
+
+TCP_SERVER_SCHEMA = cv.Schema({
+    cv.GenerateID(): cv.declare_id(P1MiniTcpServer),
+    cv.Optional(CONF_PORT, default=8088): cv.port,
+    cv.Optional(CONF_MAX_CLIENTS, default=3): cv.int_range(min=1, max=8),
+})
+
+HISTORY_COLUMN_SCHEMA = cv.Schema({
+    cv.Required(CONF_OBIS_CODE): obis_code,
+    cv.Optional(CONF_RESOLUTION): cv.positive_not_null_float,
+})
+
+def history_column(value):
+    # A code on its own is kept exactly
+    if not isinstance(value, dict):
+        value = {CONF_OBIS_CODE: obis_code(value)}
+    value = HISTORY_COLUMN_SCHEMA(value)
+    # Counters (x.8.y) are stored as the change of the change, which rounding would make
+    # drift, and are exact anyway in one or two bytes
+    if CONF_RESOLUTION in value and (packed_obis_code(value[CONF_OBIS_CODE]) >> 8) & 0xff == 8:
+        raise cv.Invalid(f"{value[CONF_OBIS_CODE]} is a counter, which is always kept exactly")
+    return value
+
+HISTORY_SCHEMA = cv.Schema({
+    cv.GenerateID(): cv.declare_id(P1MiniHistory),
+    cv.GenerateID(CONF_WEB_SERVER_BASE_ID): cv.use_id(web_server_base.WebServerBase),
+    cv.Optional(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
+    cv.Required(CONF_OBIS_CODES): cv.All(cv.ensure_list(history_column), cv.Length(min=1, max=8)),
+    cv.Optional(CONF_SIZE, default=8192): cv.int_range(min=1024, max=65536),
+    cv.Optional(CONF_PATH, default="/p1_mini/history"): cv.string,
+})
+
+SNAPSHOT_SCHEMA = text_sensor.text_sensor_schema().extend({
+    # Home Assistant does not accept text states longer than 255 characters, which 12 values
+    # keep within
+    cv.Required(CONF_OBIS_CODES): cv.All(cv.ensure_list(obis_code), cv.Length(min=1, max=12)),
+    cv.Optional(CONF_PUBLISH_SENSORS, default=True): cv.boolean,
+})
+
+def validate_whole_messages(config):
+    # When streaming, the buffer never holds the entire message
+    if config[CONF_STREAMING]:
+        if CONF_TCP_SERVER in config:
+            raise cv.Invalid(f"{CONF_TCP_SERVER} can not be used together with {CONF_STREAMING}")
+        if config[CONF_SECONDARY_REPLAY]:
+            raise cv.Invalid(f"{CONF_SECONDARY_REPLAY} can not be used together with {CONF_STREAMING}")
+    if CONF_ADAPTIVE_PERIOD in config:
+        adaptive_period = config[CONF_ADAPTIVE_PERIOD]
+        # With no minimum period the meter sends at its own pace, and adapting the period
+        # would switch back and forth between that and requesting messages
+        if config[CONF_MINIMUM_PERIOD].total_milliseconds == 0:
+            raise cv.Invalid(f"{CONF_ADAPTIVE_PERIOD} requires a {CONF_MINIMUM_PERIOD} longer than 0")
+        if adaptive_period[CONF_MAXIMUM_PERIOD] < config[CONF_MINIMUM_PERIOD]:
+            raise cv.Invalid(f"{CONF_MAXIMUM_PERIOD} can not be shorter than {CONF_MINIMUM_PERIOD}")
+        if adaptive_period[CONF_THRESHOLD] < adaptive_period[CONF_HYSTERESIS]:
+            raise cv.Invalid(f"{CONF_HYSTERESIS} can not be larger than {CONF_THRESHOLD}")
+    if CONF_AGGREGATES in config:
+        # The aggregates do not integrate the power over gaps longer than 10 seconds
+        longest_period = config[CONF_MINIMUM_PERIOD]
+        if CONF_ADAPTIVE_PERIOD in config:
+            longest_period = config[CONF_ADAPTIVE_PERIOD][CONF_MAXIMUM_PERIOD]
+        if longest_period.total_milliseconds > 10000:
+            raise cv.Invalid(f"{CONF_AGGREGATES} requires messages at least every 10 seconds, so {CONF_MINIMUM_PERIOD} and {CONF_MAXIMUM_PERIOD} can not be longer than 10s")
+    if config[CONF_SECONDARY_REPLAY] and CONF_SECONDARY_RTS not in config:
+        raise cv.Invalid(f"{CONF_SECONDARY_REPLAY} requires {CONF_SECONDARY_RTS}")
+    return config
 
 # Triggers
 ReadyToReceiveTrigger = p1_mini_ns.class_("ReadyToReceiveTrigger", automation.Trigger.template())
@@ -34,8 +273,22 @@ CommunicationErrorTrigger = p1_mini_ns.class_("CommunicationErrorTrigger", autom
 CONFIG_SCHEMA = cv.Schema({
     cv.GenerateID(): cv.declare_id(P1Mini),
     cv.Optional(CONF_SECONDARY_RTS): cv.use_id(binary_sensor.BinarySensor),
+    cv.Optional(CONF_SECONDARY_REPLAY, default=False): cv.boolean,
     cv.Optional(CONF_MINIMUM_PERIOD, default="0s"): cv.time_period,
-    cv.Optional(CONF_BUFFER_SIZE, default=3072): cv.int_range(min=512, max=32768),
+    cv.Optional(CONF_BUFFER_SIZE, default=3072): cv.Any(cv.one_of("auto", lower=True), cv.int_range(min=512, max=32768)),
+    cv.Optional(CONF_STREAMING, default=False): cv.boolean,
+    cv.Optional(CONF_FAST_RESYNC, default=False): cv.boolean,
+    cv.Optional(CONF_PUBLISH_BUDGET, default="10ms"): cv.All(
+        cv.positive_time_period_milliseconds,
+        cv.Range(min=cv.TimePeriod(milliseconds=1), max=cv.TimePeriod(milliseconds=25)),
+    ),
+    cv.Optional(CONF_READER_TASK): cv.All(cv.boolean, cv.only_with_esp_idf),
+    cv.Optional(CONF_DIAGNOSTICS): DIAGNOSTICS_SCHEMA,
+    cv.Optional(CONF_AGGREGATES): AGGREGATES_SCHEMA,
+    cv.Optional(CONF_TCP_SERVER): TCP_SERVER_SCHEMA,
+    cv.Optional(CONF_HISTORY): HISTORY_SCHEMA,
+    cv.Optional(CONF_SNAPSHOT): SNAPSHOT_SCHEMA,
+    cv.Optional(CONF_ADAPTIVE_PERIOD): ADAPTIVE_PERIOD_SCHEMA,
     cv.Optional(CONF_ON_READY_TO_RECEIVE): automation.validate_automation(
         {
             cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(ReadyToReceiveTrigger),
@@ -62,15 +315,22 @@ CONFIG_SCHEMA = cv.Schema({
         }
     )
 }).extend(cv.COMPONENT_SCHEMA).extend(uart.UART_DEVICE_SCHEMA)
+CONFIG_SCHEMA = cv.All(CONFIG_SCHEMA, validate_whole_messages)
 
 async def to_code(config):
     var = cg.new_Pvariable(
         config[CONF_ID],
         config[CONF_MINIMUM_PERIOD].total_milliseconds,
-        config[CONF_BUFFER_SIZE],
+        0 if config[CONF_BUFFER_SIZE] == "auto" else config[CONF_BUFFER_SIZE],
         )
     await cg.register_component(var, config)
     await uart.register_uart_device(var, config)
+    cg.add(var.set_streaming(config[CONF_STREAMING]))
+    cg.add(var.set_fast_resync(config[CONF_FAST_RESYNC]))
+    cg.add(var.set_publish_budget(config[CONF_PUBLISH_BUDGET].total_milliseconds))
+    if config.get(CONF_READER_TASK, False):
+        cg.add_define("USE_P1_MINI_READER_TASK")
+        cg.add(var.set_reader_task(True))
 
     for conf in config.get(CONF_ON_READY_TO_RECEIVE, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID])
@@ -100,14 +360,66 @@ async def to_code(config):
     if CONF_SECONDARY_RTS in config:
         sens = await cg.get_variable(config[CONF_SECONDARY_RTS])
         cg.add(var.set_secondary_rts(sens))
+        cg.add(var.set_secondary_replay(config[CONF_SECONDARY_REPLAY]))
 
-def obis_code(value):
-    value = cv.string(value)
-    #match = re.match(r"^\d{1,3}-\d{1,3}:\d{1,3}\.\d{1,3}\.\d{1,3}$", value)
-    # if match is None:
-    #    raise cv.Invalid(f"{value} is not a valid OBIS code")
-    return value
+    if CONF_DIAGNOSTICS in config:
+        diagnostics = config[CONF_DIAGNOSTICS]
+        cg.add(var.set_diagnostics_interval(diagnostics[CONF_UPDATE_INTERVAL].total_milliseconds))
+        for name in DIAGNOSTIC_SENSORS:
+            if name in diagnostics:
+                sens = await sensor.new_sensor(diagnostics[name])
+                cg.add(getattr(var, f"set_{name}_sensor")(sens))
 
-def identifier(value):
-    value = cv.string(value)
-    return value
+    if CONF_AGGREGATES in config:
+        aggregates = config[CONF_AGGREGATES]
+        aggregator = cg.new_Pvariable(
+            aggregates[CONF_ID],
+            packed_obis_code(aggregates[CONF_POWER_OBIS_CODE]),
+            packed_obis_code(aggregates[CONF_IMPORT_OBIS_CODE]),
+            packed_obis_code(aggregates[CONF_EXPORT_OBIS_CODE]),
+            aggregates[CONF_PEAKS],
+            )
+        cg.add(var.set_aggregator(aggregator))
+        if CONF_TIME_ID in aggregates:
+            clock = await cg.get_variable(aggregates[CONF_TIME_ID])
+            cg.add(aggregator.set_time(clock))
+        for name in AGGREGATE_SENSORS:
+            if name in aggregates:
+                sens = await sensor.new_sensor(aggregates[name])
+                cg.add(getattr(aggregator, f"set_{name}_sensor")(sens))
+
+    if CONF_SNAPSHOT in config:
+        snapshot = config[CONF_SNAPSHOT]
+        sens = await text_sensor.new_text_sensor(snapshot)
+        cg.add(var.set_snapshot_sensor(sens))
+        cg.add(var.set_publish_sensors(snapshot[CONF_PUBLISH_SENSORS]))
+        for code in snapshot[CONF_OBIS_CODES]:
+            cg.add(var.add_snapshot_obis_code(packed_obis_code(code)))
+
+    if CONF_ADAPTIVE_PERIOD in config:
+        adaptive_period = config[CONF_ADAPTIVE_PERIOD]
+        cg.add(var.set_adaptive_period(
+            adaptive_period[CONF_MAXIMUM_PERIOD].total_milliseconds,
+            adaptive_period[CONF_THRESHOLD],
+            adaptive_period[CONF_HYSTERESIS],
+            ))
+        for code in adaptive_period[CONF_OBIS_CODES]:
+            cg.add(var.add_adaptive_obis_code(packed_obis_code(code)))
+
+    if CONF_TCP_SERVER in config:
+        tcp_server = config[CONF_TCP_SERVER]
+        cg.add_define("USE_P1_MINI_TCP_SERVER")
+        server = cg.new_Pvariable(tcp_server[CONF_ID], tcp_server[CONF_PORT], tcp_server[CONF_MAX_CLIENTS])
+        cg.add(var.set_tcp_server(server))
+
+    if CONF_HISTORY in config:
+        history_config = config[CONF_HISTORY]
+        cg.add_define("USE_P1_MINI_HISTORY")
+        base = await cg.get_variable(history_config[CONF_WEB_SERVER_BASE_ID])
+        history = cg.new_Pvariable(history_config[CONF_ID], base, history_config[CONF_PATH], history_config[CONF_SIZE])
+        for column in history_config[CONF_OBIS_CODES]:
+            cg.add(history.add_obis_code(packed_obis_code(column[CONF_OBIS_CODE]), column.get(CONF_RESOLUTION, 0.0)))
+        if CONF_TIME_ID in history_config:
+            clock = await cg.get_variable(history_config[CONF_TIME_ID])
+            cg.add(history.set_time(clock))
+        cg.add(var.set_history(history))
@@ -27,6 +27,19 @@
 
 #include "esphome/core/log.h"
 #include "p1_mini.h"
+#include "p1_mini_aggregator.h"
+#include "p1_mini_history.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#ifdef USE_P1_MINI_READER_TASK
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
 
 namespace esphome {
     namespace p1_mini {
@@ -39,72 +52,135 @@ namespace esphome {
                 return (major & 0xfff) << 16 | (minor & 0xff) << 8 | (micro & 0xff);
             }
 
-            constexpr static uint32_t OBIS_ERROR{ 0xffffffff };
+            // Not a value any OBIS() call can return
+            constexpr static uint32_t OBIS_NONE{ 0xffffffff };
 
-            inline uint32_t OBIS(char const *code)
-            {
-                uint32_t major{ 0 };
-                uint32_t minor{ 0 };
-                uint32_t micro{ 0 };
+            // The CRCs are calculated one nibble at a time while the message is received, using
+            // 16 entry tables instead of 256 to save memory. Both CRCs are bit reversed, so the
+            // same update function works for both and only the table and initial value differ.
+            constexpr static uint16_t crc16_ccitt_false_table[16]{
+                0x0000, 0xcc01, 0xd801, 0x1400, 0xf001, 0x3c00, 0x2800, 0xe401,
+                0xa001, 0x6c00, 0x7800, 0xb401, 0x5000, 0x9c01, 0x8801, 0x4400
+            };
+            constexpr static uint16_t crc16_ccitt_false_init{ 0x0000 };
 
-                char const *C{ code };
-                while (std::isdigit(*C)) major = major * 10 + (*C++ - '0');
-                if (*C++ == '\0') return OBIS_ERROR;
-                while (std::isdigit(*C)) minor = minor * 10 + (*C++ - '0');
-                if (*C++ == '\0') return OBIS_ERROR;
-                while (std::isdigit(*C)) micro = micro * 10 + (*C++ - '0');
-                if (*C++ != '\0') return OBIS_ERROR;
-                return OBIS(major, minor, micro);
+            constexpr static uint16_t crc16_x25_table[16]{
+                0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+                0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f
+            };
+            constexpr static uint16_t crc16_x25_init{ 0xffff };
+
+            inline uint16_t crc16_update(uint16_t const *table, uint16_t crc, uint8_t byte)
+            {
+                crc = (crc >> 4) ^ table[(crc ^ byte) & 0x0f];
+                return (crc >> 4) ^ table[(crc ^ (byte >> 4)) & 0x0f];
             }
 
-            uint16_t crc16_ccitt_false(char *pData, int length) {
-                int i;
-                uint16_t wCrc = 0;
-                while (length--) {
-                    wCrc ^= *(unsigned char *)pData++;
-                    for (i = 0; i < 8; i++)
-                        wCrc = wCrc & 0x0001 ? (wCrc >> 1) ^ 0xA001 : wCrc >> 1;
+            constexpr static const char *TAG = "P1Mini";
+        }
+
+        namespace {
+            // ParseValue reads a value such as "12345.678" into an integer and the number of
+            // decimals, so no floating point math is needed until the value is published.
+            inline bool ParseValue(char const *C, P1MiniValue &value)
+            {
+                bool const negative{ *C == '-' };
+                if (negative) ++C;
+                if (!std::isdigit(*C)) return false;
+                int32_t mantissa{ 0 };
+                uint8_t decimals{ 0 };
+                constexpr int32_t mantissa_limit{ (INT32_MAX - 9) / 10 };
+                while (std::isdigit(*C)) {
+                    if (mantissa_limit < mantissa) return false;
+                    mantissa = mantissa * 10 + (*C++ - '0');
+                }
+                if (*C == '.') {
+                    ++C;
+                    // Decimals that do not fit are ignored
+                    while (std::isdigit(*C) && mantissa <= mantissa_limit && decimals < P1MiniValue::max_decimals) {
+                        mantissa = mantissa * 10 + (*C++ - '0');
+                        ++decimals;
+                    }
                 }
-                return wCrc;
+                value.mantissa = negative ? -mantissa : mantissa;
+                value.decimals = decimals;
+                return true;
             }
 
-            uint16_t crc16_x25(char *pData, int length) {
-                int i;
-                uint16_t wCrc = 0xffff;
-                while (length--) {
-                    wCrc ^= *(unsigned char *)pData++ << 0;
-                    for (i = 0; i < 8; i++)
-                        wCrc = wCrc & 0x0001 ? (wCrc >> 1) ^ 0x8408 : wCrc >> 1;
+            // Decodes the numeric data types in binary messages
+            inline P1MiniValue BinaryValue(char const *data)
+            {
+                uint8_t const *const D{ reinterpret_cast<uint8_t const *>(data) };
+                switch (D[0]) {
+                case 0x06: { // unsigned double long
+                    uint32_t const value{ static_cast<uint32_t>(D[1]) << 24 | static_cast<uint32_t>(D[2]) << 16 | static_cast<uint32_t>(D[3]) << 8 | D[4] };
+                    // Above the range of the mantissa, the last decimal is rounded off instead
+                    if (value > INT32_MAX) return { static_cast<int32_t>(value / 10 + (value % 10 >= 5)), 2 };
+                    return { static_cast<int32_t>(value), 3 };
                 }
-                return wCrc ^ 0xffff;
+                case 0x10: // unsigned long
+                    return { static_cast<uint16_t>(D[1] << 8 | D[2]), 1 };
+                case 0x12: // signed long
+                    return { static_cast<int16_t>(D[1] << 8 | D[2]), 1 };
+                }
+                return {};
             }
 
-            constexpr static const char *TAG = "P1Mini";
-        }
-
-        namespace {
             // ParseLine removes the need to use scanf for parsing the lines in the ASCII messages
-            inline bool ParseLine(char const *line, int &major, int &minor, int &micro, double &value)
+            inline bool ParseLine(char const *line, int &major, int &minor, int &micro, P1MiniValue &value)
             {
                 if (*line++ != '1' || *line++ != '-' || *line++ != '0' || *line++ != ':') return false;
-                auto parse_number = [&line](int &number, char end_char) -> bool {
+                auto parse_number = [&line](int &number, int max_number, char end_char) -> bool {
+                    // OBIS code parts are at most 3 digits, so longer numbers are not valid
                     number = 0;
-                    while (std::isdigit(*line)) number = number * 10 + (*line++ - '0');
-                    return *line++ == end_char;
+                    for (int digits{ 0 }; std::isdigit(*line); ++digits) {
+                        if (digits == 3) return false;
+                        number = number * 10 + (*line++ - '0');
+                    }
+                    // Larger parts would be masked by OBIS() into the code of another sensor
+                    return number <= max_number && *line++ == end_char;
                     };
-                if (!parse_number(major, '.')) return false;
-                if (!parse_number(minor, '.')) return false;
-                if (!parse_number(micro, '(')) return false;
-                value = std::atof(line);
-                return true;
+                if (!parse_number(major, 999, '.')) return false;
+                if (!parse_number(minor, 255, '.')) return false;
+                if (!parse_number(micro, 255, '(')) return false;
+                return ParseValue(line, value);
             }
         }
 
 
-        P1MiniSensorBase::P1MiniSensorBase(std::string obis_code)
-            : m_obis{ OBIS(obis_code.c_str()) }
+        float P1MiniValue::ToFloat() const
         {
-            if (m_obis == OBIS_ERROR) ESP_LOGE(TAG, "Not a valid OBIS code: '%s'", obis_code.c_str());
+            constexpr static float divisors[max_decimals + 1]{ 1.0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f };
+            return static_cast<float>(mantissa) / divisors[decimals];
+        }
+
+        int P1MiniValue::Format(char *text, size_t size) const
+        {
+            constexpr static uint32_t divisors[max_decimals + 1]{ 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+            uint32_t const magnitude{ mantissa < 0 ? 0u - static_cast<uint32_t>(mantissa) : static_cast<uint32_t>(mantissa) };
+            char const *const sign{ mantissa < 0 ? "-" : "" };
+            if (decimals == 0) return snprintf(text, size, "%s%u", sign, magnitude);
+            return snprintf(text, size, "%s%u.%0*u", sign, magnitude / divisors[decimals], decimals, magnitude % divisors[decimals]);
+        }
+
+        bool P1MiniSensorBase::ShouldPublish(P1MiniValue value, uint32_t now)
+        {
+            if (m_has_published && (m_max_interval_ms == 0 || now - m_last_publish_time < m_max_interval_ms)) {
+                if (m_publish_on_change && value.mantissa == m_last_value.mantissa && value.decimals == m_last_value.decimals) return false;
+                if (m_delta > 0.0f) {
+                    if (value.decimals != m_delta_decimals) {
+                        // Only calculated when the number of decimals changes, which normally
+                        // means only for the first value.
+                        m_delta_decimals = value.decimals;
+                        m_delta_mantissa = std::llround(m_delta * std::pow(10.0f, value.decimals));
+                    }
+                    if (value.decimals == m_last_value.decimals && std::abs(static_cast<int64_t>(value.mantissa) - m_last_value.mantissa) < m_delta_mantissa) return false;
+                }
+            }
+            m_has_published = true;
+            m_last_value = value;
+            m_last_publish_time = now;
+            return true;
         }
 
         P1MiniTextSensorBase::P1MiniTextSensorBase(std::string identifier)
@@ -115,53 +191,158 @@ namespace esphome {
 
         P1Mini::P1Mini(uint32_t min_period_ms, int buffer_size)
             : m_error_recovery_time{ millis() }
-            , m_message_buffer_size{ buffer_size }
+            , m_auto_buffer_size{ buffer_size == 0 }
             , m_min_period_ms{ min_period_ms }
+            , m_period_ms{ min_period_ms }
         {
-            m_message_buffer = new char[m_message_buffer_size];
-            if (m_message_buffer == nullptr) {
-                ESP_LOGE(TAG, "Failed to allocate %d bytes for buffer.", m_message_buffer_size);
+            if (!AllocateBuffer(m_auto_buffer_size ? auto_buffer_initial_size : buffer_size)) {
                 static char dummy[2];
                 m_message_buffer = dummy;
                 m_message_buffer_size = 2;
             }
-            else {
-                m_message_buffer_UP.reset(m_message_buffer);
+        }
+
+        bool P1Mini::AllocateBuffer(int size)
+        {
+            char *const buffer{ new char[size] };
+            if (buffer == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate %d bytes for buffer.", size);
+                return false;
+            }
+            // Bytes already received for the next message are kept
+            m_received_position = std::min(m_received_position, size);
+            if (m_received_position != 0) std::memcpy(buffer, m_message_buffer, m_received_position);
+            m_message_buffer_UP.reset(buffer);
+            m_message_buffer = buffer;
+            m_message_buffer_size = size;
+            return true;
+        }
+
+        void P1Mini::LearnBufferSize(bool overrun)
+        {
+            if (overrun) {
+                // Start over with a larger buffer
+                if (m_message_buffer_size < auto_buffer_max_size) {
+                    m_new_buffer_size = std::min(m_message_buffer_size * 2, auto_buffer_max_size);
+                }
+                m_num_learned_messages = 0;
+                m_learned_size = 0;
+                return;
             }
+
+            // After a few messages, fit the buffer to the largest of them with some margin
+            m_learned_size = std::max(m_learned_size, m_message_high_water_mark);
+            if (++m_num_learned_messages != auto_buffer_learn_messages) return;
+            int const margin{ std::max(m_learned_size / 8, 128) };
+            int const size{ std::min((m_learned_size + margin + 63) & ~63, auto_buffer_max_size) };
+            if (m_learned_size + margin / 2 <= m_message_buffer_size && m_message_buffer_size <= m_learned_size + margin * 2) return;
+            m_new_buffer_size = size;
         }
 
+        void P1Mini::ChangeBufferSize()
+        {
+            if (m_new_buffer_size == 0) return;
+            // The buffer is not in use between messages
+            ReleaseBuffer();
+            if (AllocateBuffer(m_new_buffer_size)) ESP_LOGI(TAG, "Buffer size changed to %d bytes", m_message_buffer_size);
+            m_new_buffer_size = 0;
+        }
+
+        std::vector<P1Mini *> P1Mini::s_instances;
+        P1Mini *P1Mini::s_processing_instance{ nullptr };
+
         void P1Mini::setup() {
             //ESP_LOGD("P1Mini", "setup()");
+            s_instances.push_back(this);
+            for (uint32_t const obis : m_adaptive_obis_codes) {
+                SensorEntry *const entry{ FindSensorEntry(obis) };
+                if (entry != nullptr) entry->adaptive = true;
+                else ESP_LOGW(TAG, "No sensor with obis code %d.%d.%d for the adaptive period", obis >> 16, (obis >> 8) & 0xff, obis & 0xff);
+            }
+            for (SensorEntry &entry : m_sensors) entry.in_snapshot = m_snapshot_obis_codes.empty();
+            for (uint32_t const obis : m_snapshot_obis_codes) {
+                SensorEntry *const entry{ FindSensorEntry(obis) };
+                if (entry != nullptr) entry->in_snapshot = true;
+                else ESP_LOGW(TAG, "No sensor with obis code %d.%d.%d for the snapshot", obis >> 16, (obis >> 8) & 0xff, obis & 0xff);
+            }
+#ifdef USE_P1_MINI_HISTORY
+            if (m_history != nullptr) m_history->Setup();
+#endif
+#ifdef USE_P1_MINI_READER_TASK
+            if (m_reader_task) {
+                // Room for a whole message, so the main loop can fall behind by that much
+                m_ring.reset(new P1MiniRing(m_auto_buffer_size ? auto_buffer_max_size / 8 : m_message_buffer_size));
+                if (xTaskCreate(ReaderTask, "p1_mini_reader", 2048, this, 5, nullptr) != pdPASS) {
+                    ESP_LOGE(TAG, "Failed to start the reader task. Reading in the main loop.");
+                    m_ring.reset();
+                }
+            }
+#endif
+        }
+
+#ifdef USE_P1_MINI_READER_TASK
+        void P1Mini::ReaderTask(void *param)
+        {
+            P1Mini *const p1_mini{ static_cast<P1Mini *>(param) };
+            uint8_t chunk[128];
+            for (;;) {
+                // When the ring is full, the data is left in the UART buffer until there is room
+                size_t const num_to_read{ std::min({ static_cast<size_t>(p1_mini->available()), sizeof(chunk), p1_mini->m_ring->Free() }) };
+                if (num_to_read == 0) {
+                    vTaskDelay(1);
+                    continue;
+                }
+                p1_mini->read_array(chunk, num_to_read);
+                p1_mini->m_ring->Write(chunk, num_to_read);
+            }
         }
+#endif
 
         void P1Mini::loop() {
+            uint32_t const start_time{ micros() };
+            RunStateMachine();
+            if (m_secondary_replay) Replay();
+#ifdef USE_P1_MINI_TCP_SERVER
+            if (m_tcp_server != nullptr) m_tcp_server->Loop();
+#endif
+#ifdef USE_P1_MINI_HISTORY
+            if (m_history != nullptr) m_history->Loop();
+#endif
+            uint32_t const loop_time{ micros() - start_time };
+            if (m_longest_loop_time < loop_time) {
+                m_longest_loop_time = loop_time;
+                // The processing states try to stay within 25 ms, so this should not happen
+                constexpr uint32_t loop_time_budget_us{ 25000 };
+                if (loop_time_budget_us < loop_time) ESP_LOGW(TAG, "loop() took %u ms", loop_time / 1000);
+            }
+
+            if (m_diagnostics_interval_ms != 0 && m_diagnostics_interval_ms <= millis() - m_diagnostics_time) PublishDiagnostics();
+        }
+
+        void P1Mini::RunStateMachine() {
             unsigned long const loop_start_time{ millis() };
+            bool const processing{ m_state == states::PROCESSING_ASCII || m_state == states::PROCESSING_BINARY || m_state == states::PUBLISHING };
+            if (processing && !AcquireProcessing(loop_start_time)) return;
             switch (m_state) {
             case states::IDENTIFYING_MESSAGE:
-                if (!available()) {
+                if (m_received_position == 0 && !Available()) {
                     constexpr unsigned long max_wait_time_ms{ 60000 };
                     if (max_wait_time_ms < loop_start_time - m_identifying_message_time) {
-                        ESP_LOGW(TAG, "No data received for %d seconds.", max_wait_time_ms / 1000);
-                        ChangeState(states::ERROR_RECOVERY);
+                        ESP_LOGW(TAG, "No data received for %lu seconds.", max_wait_time_ms / 1000);
+                        Reset(errors::TIMEOUT);
                     }
                     break;
                 }
                 {
-                    char const read_byte{ GetByte() };
-                    if (read_byte == '/') {
-                        ESP_LOGD(TAG, "ASCII data format");
-                        m_data_format = data_formats::ASCII;
-                    }
-                    else if (read_byte == 0x7e) {
-                        ESP_LOGD(TAG, "BINARY data format");
-                        m_data_format = data_formats::BINARY;
-                    }
-                    else {
+                    // The message may have started with the end of the last one
+                    ReleaseBuffer();
+                    if (m_received_position == 0) m_message_buffer[m_received_position++] = GetByte();
+                    char const read_byte{ m_message_buffer[m_message_buffer_position++] };
+                    if (!StartMessage(read_byte)) {
                         ESP_LOGW(TAG, "Unknown data format (0x%02x). Resetting.", read_byte);
-                        ChangeState(states::ERROR_RECOVERY);
+                        Reset(errors::FORMAT);
                         return;
                     }
-                    m_message_buffer[m_message_buffer_position++] = read_byte;
                     ChangeState(states::READING_MESSAGE);
                 }
                 // Not breaking here! The delay caused by exiting the loop function here can cause
@@ -169,73 +350,138 @@ namespace esphome {
                 // part.
             case states::READING_MESSAGE:
                 ++m_num_message_loops;
-                while (available()) {
-                    // While data is available, read it one byte at a time.
-                    char const read_byte{ GetByte() };
+                // After a resync, there can be bytes left to go through even if nothing new is available
+                for (int num_available{ Available() }; num_available != 0 || m_message_buffer_position < m_received_position; num_available = Available()) {
+                    // Read everything that is available, as far as it fits in the buffer, in one go
+                    // and pass it on to the secondary P1 port the same way.
+                    // Close to the size of the UART buffer, data will soon be lost between loops
+                    if (m_uart_backlog < num_available) m_uart_backlog = num_available;
+                    int num_to_read{ std::min(num_available, m_message_buffer_size - m_received_position) };
+                    // Once the end of the message is known, nothing after it is read. What is read
+                    // after it anyway, before the end was known, is kept for the next message.
+                    if (m_crc_position != 0) {
+                        int const end{ m_data_format == data_formats::BINARY ? m_crc_position + 3 : std::max(m_crc_position + 6, m_message_buffer_position + 1) };
+                        num_to_read = std::max(std::min(num_to_read, end - m_received_position), 0);
+                    }
+                    if (num_to_read == 0 && m_message_buffer_position == m_received_position) break;
+                    if (num_to_read != 0) {
+                        uint8_t *const chunk{ reinterpret_cast<uint8_t *>(m_message_buffer + m_received_position) };
+                        ReadArray(chunk, num_to_read);
+                        if (m_secondary_p1) write_array(chunk, num_to_read);
+                        m_received_position += num_to_read;
+                        if (m_message_high_water_mark < m_received_position) m_message_high_water_mark = m_received_position;
+                    }
 
-                    m_message_buffer[m_message_buffer_position++] = read_byte;
+                    // Then go through the new bytes one at a time
+                    while (m_message_buffer_position < m_received_position) {
+                        char const read_byte{ m_message_buffer[m_message_buffer_position++] };
 
-                    // Find out where CRC will be positioned
-                    if (m_data_format == data_formats::ASCII && read_byte == '!') {
-                        // The exclamation mark indicates that the main message is complete
-                        // and the CRC will come next.
-                        m_crc_position = m_message_buffer_position;
-                    }
-                    else if (m_data_format == data_formats::BINARY && m_message_buffer_position == 3) {
-                        if ((0xe0 & m_message_buffer[1]) != 0xa0) {
-                            ESP_LOGW(TAG, "Unknown frame format (0x%02X). Resetting.", read_byte);
-                            ChangeState(states::ERROR_RECOVERY);
-                            return;
+                        // Consecutive flags between binary frames are skipped, so a closing flag
+                        // found by a resync can be followed by the opening flag of the next frame.
+                        if (m_data_format == data_formats::BINARY && m_message_buffer_position == 2 && read_byte == 0x7e) {
+                            std::memmove(m_message_buffer, m_message_buffer + 1, --m_received_position);
+                            m_message_buffer_position = 1;
+                            continue;
                         }
-                        m_crc_position = ((0x1f & m_message_buffer[1]) << 8) + m_message_buffer[2] - 1;
-                    }
 
-                    // If end of CRC is reached, start verifying CRC
-                    if (m_crc_position > 0 && m_message_buffer_position > m_crc_position) {
-                        if (m_data_format == data_formats::ASCII && read_byte == '\n') {
-                            ChangeState(states::VERIFYING_CRC);
-                            return;
+                        // Keep the CRC updated with every byte up to where the CRC itself is positioned.
+                        if (m_crc_position == 0 || m_message_buffer_position <= m_crc_position) {
+                            m_crc = crc16_update(m_data_format == data_formats::BINARY ? crc16_x25_table : crc16_ccitt_false_table, m_crc, read_byte);
                         }
-                        else if (m_data_format == data_formats::BINARY && m_message_buffer_position == m_crc_position + 3) {
-                            if (read_byte != 0x7e) {
-                                ESP_LOGW(TAG, "Unexpected end. Resetting.");
-                                ChangeState(states::ERROR_RECOVERY);
+
+                        // Find out where CRC will be positioned
+                        if (m_data_format == data_formats::ASCII && read_byte == '!') {
+                            // The exclamation mark indicates that the main message is complete
+                            // and the CRC will come next.
+                            m_crc_position = m_message_buffer_position;
+                        }
+                        else if (m_data_format == data_formats::BINARY && m_message_buffer_position == 3) {
+                            if ((0xe0 & m_message_buffer[1]) != 0xa0) {
+                                ESP_LOGW(TAG, "Unknown frame format (0x%02X). Resetting.", read_byte);
+                                Reset(errors::FORMAT);
                                 return;
                             }
-                            ChangeState(states::VERIFYING_CRC);
+                            m_crc_position = ((0x1f & static_cast<uint8_t>(m_message_buffer[1])) << 8) + static_cast<uint8_t>(m_message_buffer[2]) - 1;
+                        }
+
+                        // When streaming, each line is processed as soon as it is complete and the
+                        // buffer is reused for the next line.
+                        if (m_streaming && m_data_format == data_formats::ASCII && m_crc_position == 0 && read_byte == '\n') {
+                            ProcessAsciiLine(m_message_buffer);
+                            m_message_length += m_message_buffer_position;
+                            m_received_position -= m_message_buffer_position;
+                            std::memmove(m_message_buffer, m_message_buffer + m_message_buffer_position, m_received_position);
+                            m_message_buffer_position = 0;
+                        }
+
+                        // If end of CRC is reached, start verifying CRC
+                        if (m_crc_position > 0 && m_message_buffer_position > m_crc_position) {
+                            if (m_data_format == data_formats::ASCII && read_byte == '\n') {
+                                ChangeState(states::VERIFYING_CRC);
+                                return;
+                            }
+                            else if (m_data_format == data_formats::BINARY && m_message_buffer_position == m_crc_position + 3) {
+                                if (read_byte != 0x7e) {
+                                    ESP_LOGW(TAG, "Unexpected end. Resetting.");
+                                    Reset(errors::FORMAT);
+                                    return;
+                                }
+                                ChangeState(states::VERIFYING_CRC);
+                                return;
+                            }
+                        }
+                        if (m_message_buffer_position == m_message_buffer_size) {
+                            ESP_LOGW(TAG, "Message buffer overrun. Resetting.");
+                            Reset(errors::BUFFER_OVERRUN);
                             return;
                         }
                     }
-                    if (m_message_buffer_position == m_message_buffer_size) {
-                        ESP_LOGW(TAG, "Message buffer overrun. Resetting.");
-                        ChangeState(states::ERROR_RECOVERY);
-                        return;
-                    }
-
                 }
                 {
                     constexpr unsigned long max_message_time_ms{ 10000 };
                     if (max_message_time_ms < loop_start_time - m_reading_message_time && m_reading_message_time < loop_start_time) {
-                        ESP_LOGW(TAG, "Complete message not received within %d seconds. Resetting.", max_message_time_ms / 1000);
-                        ChangeState(states::ERROR_RECOVERY);
+                        ESP_LOGW(TAG, "Complete message not received within %lu seconds. Resetting.", max_message_time_ms / 1000);
+                        Reset(errors::TIMEOUT);
                     }
                 }
                 break;
             case states::VERIFYING_CRC: {
+                // The CRC has been calculated while the message was received, so only the
+                // comparison remains.
                 int crc_from_msg = -1;
                 int crc = 0;
 
                 if (m_data_format == data_formats::ASCII) {
                     crc_from_msg = (int)strtol(m_message_buffer + m_crc_position, NULL, 16);
-                    crc = crc16_ccitt_false(m_message_buffer, m_crc_position);
+                    crc = m_crc;
                 }
                 else if (m_data_format == data_formats::BINARY) {
-                    crc_from_msg = (m_message_buffer[m_crc_position + 1] << 8) + m_message_buffer[m_crc_position];
-                    crc = crc16_x25(&m_message_buffer[1], m_crc_position - 1);
+                    crc_from_msg = (static_cast<uint8_t>(m_message_buffer[m_crc_position + 1]) << 8) + static_cast<uint8_t>(m_message_buffer[m_crc_position]);
+                    crc = m_crc ^ 0xffff;
                 }
                 
+                m_message_length += m_message_buffer_position;
                 if (crc == crc_from_msg) {
                     ESP_LOGD(TAG, "CRC verification OK");
+                    MessageVerified();
+                    // Only happens if the next message started arriving before the end of this one
+                    // was read, which means loop() has not been called for a while, or with frames
+                    // sent back to back.
+                    m_num_carried = m_received_position - m_message_buffer_position;
+                    if (m_fast_resync && m_num_carried != 0) {
+                        // Only from where the next message starts, so noise between the two
+                        // does not cost that message too
+                        int const start{ FindMessageStart(m_message_buffer_position) };
+                        int const end{ start < 0 ? m_received_position : start };
+                        for (int i{ m_message_buffer_position }; i < end; ++i) AddByteToDiscardLog(m_message_buffer[i]);
+                        FlushDiscardLog();
+                        m_num_carried = m_received_position - end;
+                    }
+                    if (m_num_carried != 0) ESP_LOGD(TAG, "Keeping %d bytes received after the end of the message", m_num_carried);
+#ifdef USE_P1_MINI_TCP_SERVER
+                    if (m_tcp_server != nullptr) m_tcp_server->SendMessage(m_message_buffer, m_message_buffer_position);
+#endif
+                    if (m_secondary_replay) CacheForReplay();
                     ChangeState(m_data_format == data_formats::BINARY ? states::PROCESSING_BINARY : states::PROCESSING_ASCII);
                     return;
                 }
@@ -244,49 +490,21 @@ namespace esphome {
                 ESP_LOGE(TAG, "CRC mismatch, calculated %04X != %04X. Buffer discarded.", crc, crc_from_msg);
                 for (int i{ 0 }; i < m_message_buffer_position; ++i) AddByteToDiscardLog(m_message_buffer[i]);
                 FlushDiscardLog();
-                ChangeState(states::ERROR_RECOVERY);
+                Reset(errors::CRC);
                 return;
             }
             case states::PROCESSING_ASCII:
                 ++m_num_processing_loops;
+                if (m_streaming) {
+                    // The lines have already been processed while the message was received
+                    ChangeState(states::PUBLISHING);
+                    return;
+                }
                 do {
                     while (*m_start_of_data == '\n' || *m_start_of_data == '\r') ++m_start_of_data;
-                    char *end_of_line{ m_start_of_data };
-                    while (*end_of_line != '\n' && *end_of_line != '\r' && *end_of_line != '\0' && *end_of_line != '!') ++end_of_line;
-                    char const end_of_line_char{ *end_of_line };
-                    *end_of_line = '\0';
-
-                    if (end_of_line != m_start_of_data) {
-                        int minor{ -1 }, major{ -1 }, micro{ -1 };
-                        double value{ -1.0 };
-                        bool matched_sensor{ false };
-                        bool is_regular_sensor{ ParseLine(m_start_of_data, major, minor, micro, value) && !std::isnan(value) };
-                        if (is_regular_sensor) {
-                            auto iter{ m_sensors.find(OBIS(major, minor, micro)) };
-                            if (iter != m_sensors.end()) {
-                                matched_sensor = true;
-                                iter->second->publish_val(value);
-                            }
-                        }
-                        if (!matched_sensor) {
-                            for (IP1MiniTextSensor *text_sensor : m_text_sensors) {
-                                if (strncmp(m_start_of_data, text_sensor->Identifier().c_str(), text_sensor->Identifier().size()) == 0) {
-                                    matched_sensor = true;
-                                    text_sensor->publish_val(m_start_of_data);
-                                    break;
-                                }
-                            }
-                        }
-                        if (!matched_sensor) {
-                            if (is_regular_sensor)
-                                ESP_LOGD(TAG, "No sensor matched line '%s' with obis code %d.%d.%d", m_start_of_data, major, minor, micro);
-                            else
-                                ESP_LOGD(TAG, "No sensor matched line '%s'", m_start_of_data);
-                        }
-                    }
-                    *end_of_line = end_of_line_char;
-                    if (end_of_line_char == '\0' || end_of_line_char == '!') {
-                        ChangeState(states::WAITING);
+                    char *const end_of_line{ ProcessAsciiLine(m_start_of_data) };
+                    if (*end_of_line == '\0' || *end_of_line == '!') {
+                        ChangeState(states::PUBLISHING);
                         return;
                     }
                     m_start_of_data = end_of_line + 1;
@@ -295,125 +513,183 @@ namespace esphome {
             case states::PROCESSING_BINARY: {
                 ++m_num_processing_loops;
                 if (m_start_of_data == m_message_buffer) {
+                    if (ProcessCachedBinaryLayout()) {
+                        ChangeState(states::PUBLISHING);
+                        return;
+                    }
+                    // Learn the layout again while processing the message
+                    m_binary_layout.clear();
+                    m_binary_layout_length = 0;
+                    m_obis_code_offset = 0;
+
                     m_start_of_data += 3;
-                    while (*m_start_of_data != 0x13 && m_start_of_data <= m_message_buffer + m_crc_position) ++m_start_of_data;
-                    if (m_start_of_data > m_message_buffer + m_crc_position) {
+                    while (m_start_of_data <= m_message_buffer + m_crc_position && *m_start_of_data != 0x13) ++m_start_of_data;
+                    // The data starts 6 bytes after the control byte, so that must still be in
+                    // the message
+                    if (m_crc_position - (m_start_of_data - m_message_buffer) <= 6) {
                         ESP_LOGW(TAG, "Could not find control byte. Resetting.");
-                        ChangeState(states::ERROR_RECOVERY);
+                        Reset(errors::FORMAT);
                         return;
                     }
                     m_start_of_data += 6;
                 }
 
                 do {
-                    uint8_t type = *m_start_of_data;
+                    uint8_t const *const data{ reinterpret_cast<uint8_t const *>(m_start_of_data) };
+                    int const remaining{ static_cast<int>(m_message_buffer + m_crc_position - m_start_of_data) };
+                    if (remaining <= 0) {
+                        ESP_LOGW(TAG, "Data continues past the end of the message. Resetting.");
+                        Reset(errors::FORMAT);
+                        return;
+                    }
+                    uint8_t const type{ data[0] };
+
+                    // Size of the data element, including the type, so it can be checked against
+                    // the end of the message before anything is read from it.
+                    int size;
                     switch (type) {
                     case 0x00:
-                        m_start_of_data++;
+                        size = 1;
                         break;
                     case 0x01: // array
-                        m_start_of_data += 2;
-                        break;
                     case 0x02: // struct
-                        m_start_of_data += 2;
+                    case 0x0f: // scalar
+                    case 0x16: // enum
+                        size = 2;
                         break;
-                    case 0x06: {// unsigned double long
-                        uint32_t v = (*(m_start_of_data + 1) << 24 | *(m_start_of_data + 2) << 16 | *(m_start_of_data + 3) << 8 | *(m_start_of_data + 4));
-                        float fv = v * 1.0 / 1000;
-                        auto iter{ m_sensors.find(m_obis_code) };
-                        if (iter != m_sensors.end()) iter->second->publish_val(fv);
-                        m_start_of_data += 1 + 4;
+                    case 0x06: // unsigned double long
+                        size = 1 + 4;
                         break;
-                    }
-                    case 0x09: // octet
-                        if (*(m_start_of_data + 1) == 0x06) {
-                            int minor{ -1 }, major{ -1 }, micro{ -1 };
-                            major = *(m_start_of_data + 4);
-                            minor = *(m_start_of_data + 5);
-                            micro = *(m_start_of_data + 6);
-
-                            m_obis_code = OBIS(major, minor, micro);
-                        }
-                        m_start_of_data += 2 + (int)*(m_start_of_data + 1);
+                    case 0x10: // unsigned long
+                    case 0x12: // signed long
+                        size = 1 + 2;
                         break;
+                    case 0x09: // octet
                     case 0x0a: // string
-                        m_start_of_data += 2 + (int)*(m_start_of_data + 1);
+                        size = remaining < 2 ? 2 : 2 + data[1];
                         break;
                     case 0x0c: // datetime
-                        m_start_of_data += 13;
-                        break;
-                    case 0x0f: // scalar
-                        m_start_of_data += 2;
-                        break;
-                    case 0x10: {// unsigned long
-                        uint16_t v = (*(m_start_of_data + 1) << 8 | *(m_start_of_data + 2));
-                        float fv = v * 1.0 / 10;
-                        auto iter{ m_sensors.find(m_obis_code) };
-                        if (iter != m_sensors.end()) iter->second->publish_val(fv);
-                        m_start_of_data += 3;
-                        break;
-                    }
-                    case 0x12: {// signed long
-                        int16_t v = (*(m_start_of_data + 1) << 8 | *(m_start_of_data + 2));
-                        float fv = v * 1.0 / 10;
-                        auto iter{ m_sensors.find(m_obis_code) };
-                        if (iter != m_sensors.end()) iter->second->publish_val(fv);
-                        m_start_of_data += 3;
-                        break;
-                    }
-                    case 0x16: // enum
-                        m_start_of_data += 2;
+                        size = 13;
                         break;
                     default:
                         ESP_LOGW(TAG, "Unsupported data type 0x%02x. Resetting.", type);
-                        ChangeState(states::ERROR_RECOVERY);
+                        Reset(errors::FORMAT);
                         return;
                     }
+                    if (remaining < size) {
+                        ESP_LOGW(TAG, "Data type 0x%02x continues past the end of the message. Resetting.", type);
+                        Reset(errors::FORMAT);
+                        return;
+                    }
+
+                    if (type == 0x06 || type == 0x10 || type == 0x12) {
+                        P1MiniValue const value{ BinaryValue(m_start_of_data) };
+                        IP1MiniSensor *const sensor{ FindSensor(m_obis_code) };
+                        if (sensor != nullptr) {
+                            StageValue(sensor, value);
+                            if (m_obis_code_offset != 0) {
+                                m_binary_layout.push_back({ m_obis_code, m_obis_code_offset, static_cast<uint16_t>(m_start_of_data - m_message_buffer), type, sensor });
+                            }
+                        }
+                    }
+                    else if (type == 0x09 && data[1] == 0x06) {
+                        m_obis_code = OBIS(data[4], data[5], data[6]);
+                        m_obis_code_offset = m_start_of_data - m_message_buffer;
+                    }
+                    m_start_of_data += size;
                     if (m_start_of_data >= m_message_buffer + m_crc_position) {
-                        ChangeState(states::WAITING);
+                        m_binary_layout_length = m_crc_position;
+                        ChangeState(states::PUBLISHING);
                         return;
                     }
                 } while (millis() - loop_start_time < 25);
                 break;
             }
+            case states::PUBLISHING:
+                // Publishing can be slow, so it is spread over as many loops as needed to stay
+                // within the time budget.
+                ++m_num_publishing_loops;
+                do {
+                    if (m_num_staged_published < m_staged_values.size()) {
+                        StagedValue const &staged{ m_staged_values[m_num_staged_published++] };
+                        PublishValue(staged.sensor, staged.value);
+                    }
+                    else if (m_num_staged_published - m_staged_values.size() < m_num_staged_texts) {
+                        StagedText const &staged{ m_staged_texts[m_num_staged_published++ - m_staged_values.size()] };
+                        if (staged.sensor->publish_val(staged.value.data(), staged.value.size())) ++m_num_published;
+                    }
+                    else {
+                        if (m_snapshot_sensor != nullptr) PublishSnapshot();
+                        ChangeState(states::WAITING);
+                        return;
+                    }
+                } while (millis() - loop_start_time < m_publish_budget_ms);
+                break;
             case states::WAITING:
                 if (m_display_time_stats) {
                     m_display_time_stats = false;
                     if (m_time_stats_as_info_next == ++m_time_stats_counter) {
                         m_time_stats_as_info_next <<= 1;
-                        ESP_LOGI(TAG, "Cycle times: Identifying = %d ms, Message = %d ms (%d loops), Processing = %d ms (%d loops), (Total = %d ms). %d bytes in buffer",
-                            m_reading_message_time - m_identifying_message_time,
-                            m_processing_time - m_reading_message_time,
-                            m_num_message_loops,
-                            m_waiting_time - m_processing_time,
-                            m_num_processing_loops,
-                            m_waiting_time - m_identifying_message_time,
-                            m_message_buffer_position
+                        ESP_LOGI(TAG, "Cycle times: Identifying = %u ms, Message = %u ms (%d loops), Processing = %u ms (%d loops), Publishing = %u ms (%d loops), (Total = %u ms). %d bytes in message (%d bytes/s), %d values published, %d of %d lines predicted",
+                            m_last_cycle.identifying_time,
+                            m_last_cycle.message_time,
+                            m_last_cycle.message_loops,
+                            m_last_cycle.processing_time,
+                            m_last_cycle.processing_loops,
+                            m_last_cycle.publishing_time,
+                            m_last_cycle.publishing_loops,
+                            m_last_cycle.identifying_time + m_last_cycle.message_time + m_last_cycle.processing_time + m_last_cycle.publishing_time,
+                            m_last_cycle.message_length,
+                            BytesPerSecond(),
+                            m_last_cycle.num_published,
+                            m_last_cycle.num_predicted_lines,
+                            m_last_cycle.num_lines
                         );
                     }
                     else
-                        ESP_LOGD(TAG, "Cycle times: Identifying = %d ms, Message = %d ms (%d loops), Processing = %d ms (%d loops), (Total = %d ms). %d bytes in buffer",
-                            m_reading_message_time - m_identifying_message_time,
-                            m_processing_time - m_reading_message_time,
-                            m_num_message_loops,
-                            m_waiting_time - m_processing_time,
-                            m_num_processing_loops,
-                            m_waiting_time - m_identifying_message_time,
-                            m_message_buffer_position
+                        ESP_LOGD(TAG, "Cycle times: Identifying = %u ms, Message = %u ms (%d loops), Processing = %u ms (%d loops), Publishing = %u ms (%d loops), (Total = %u ms). %d bytes in message (%d bytes/s), %d values published, %d of %d lines predicted",
+                            m_last_cycle.identifying_time,
+                            m_last_cycle.message_time,
+                            m_last_cycle.message_loops,
+                            m_last_cycle.processing_time,
+                            m_last_cycle.processing_loops,
+                            m_last_cycle.publishing_time,
+                            m_last_cycle.publishing_loops,
+                            m_last_cycle.identifying_time + m_last_cycle.message_time + m_last_cycle.processing_time + m_last_cycle.publishing_time,
+                            m_last_cycle.message_length,
+                            BytesPerSecond(),
+                            m_last_cycle.num_published,
+                            m_last_cycle.num_predicted_lines,
+                            m_last_cycle.num_lines
                     );
                 }
-                if (m_min_period_ms == 0 || m_min_period_ms < loop_start_time - m_identifying_message_time) {
-                    ChangeState(states::IDENTIFYING_MESSAGE);
+                if (m_period_ms == 0 || m_period_ms < loop_start_time - m_identifying_message_time) {
+                    // Only meters controlled by RTS wait for their turn, the others send anyway
+                    if (m_period_ms != 0 && OtherMeterSending(loop_start_time)) StartSchedulingWait(loop_start_time);
+                    else {
+                        EndSchedulingWait(loop_start_time);
+                        ChangeState(states::IDENTIFYING_MESSAGE);
+                    }
                 }
-                else if (available()) {
+                else if (m_num_carried != 0 || Available()) {
                     ESP_LOGE(TAG, "Data was received before beeing requested. If flow control via the RTS signal is not used, the minimum_period should be set to 0s in the yaml. Resetting.");
-                    ChangeState(states::ERROR_RECOVERY);
+                    Reset(errors::UNREQUESTED_DATA);
                 }
                 break;
             case states::ERROR_RECOVERY:
-                if (available()) {
-                    int max_bytes_to_discard{ 200 };
-                    do { AddByteToDiscardLog(GetByte()); } while (available() && max_bytes_to_discard-- != 0);
+                if (int const num_available{ Available() }) {
+                    // The message buffer is not in use here, so borrow it for reading
+                    int const num_to_discard{ std::min({ num_available, 200, m_message_buffer_size }) };
+                    uint8_t *const discarded{ reinterpret_cast<uint8_t *>(m_message_buffer) };
+                    ReadArray(discarded, num_to_discard);
+                    if (m_secondary_p1) write_array(discarded, num_to_discard);
+                    m_received_position = num_to_discard;
+                    int const start{ m_fast_resync ? FindMessageStart(0) : -1 };
+                    for (int i{ 0 }; i < (start < 0 ? num_to_discard : start); ++i) AddByteToDiscardLog(discarded[i]);
+                    if (start >= 0) {
+                        FlushDiscardLog();
+                        Resync(start);
+                    }
                 }
                 else if (500 < loop_start_time - m_error_recovery_time) {
                     ChangeState(states::WAITING);
@@ -423,16 +699,91 @@ namespace esphome {
             }
         }
 
+        void P1Mini::CacheForReplay()
+        {
+            // A message that is still being sent is not replaced. If the secondary port keeps
+            // asking for data, it gets the next one instead.
+            if (m_replay_position < m_replay_buffer.size()) {
+                ESP_LOGD(TAG, "Secondary port still receiving the previous message");
+                return;
+            }
+            m_replay_buffer.assign(m_message_buffer, m_message_buffer + m_message_buffer_position);
+            // Send it right away if the secondary port is already asking for data
+            m_replay_position = m_secondary_rts_state ? 0 : m_replay_buffer.size();
+        }
+
+        void P1Mini::Replay()
+        {
+            bool const rts{ m_secondary_rts != nullptr && m_secondary_rts->state };
+            if (rts && !m_secondary_rts_state && m_replay_position == m_replay_buffer.size()) m_replay_position = 0;
+            m_secondary_rts_state = rts;
+
+            // A little at a time, so loop() is never blocked for long while the UART sends it
+            constexpr size_t max_chunk_size{ 128 };
+            size_t const chunk_size{ std::min(max_chunk_size, m_replay_buffer.size() - m_replay_position) };
+            if (chunk_size == 0) return;
+            write_array(m_replay_buffer.data() + m_replay_position, chunk_size);
+            m_replay_position += chunk_size;
+        }
+
+        bool P1Mini::AcquireProcessing(unsigned long current_time)
+        {
+            if (s_processing_instance != nullptr && s_processing_instance != this) {
+                StartSchedulingWait(current_time);
+                return false;
+            }
+            s_processing_instance = this;
+            EndSchedulingWait(current_time);
+            return true;
+        }
+
+        void P1Mini::ReleaseProcessing()
+        {
+            if (s_processing_instance == this) s_processing_instance = nullptr;
+        }
+
+        bool P1Mini::OtherMeterSending(unsigned long current_time) const
+        {
+            for (P1Mini const *const other : s_instances) {
+                if (other == this || other->m_period_ms == 0) continue;
+                if (other->m_state == states::READING_MESSAGE) return true;
+                if (other->m_state == states::IDENTIFYING_MESSAGE && current_time - other->m_identifying_message_time < max_identifying_wait_ms) return true;
+            }
+            return false;
+        }
+
+        void P1Mini::StartSchedulingWait(unsigned long current_time)
+        {
+            if (m_scheduling_waiting) return;
+            m_scheduling_waiting = true;
+            m_scheduling_wait_time = current_time;
+        }
+
+        void P1Mini::EndSchedulingWait(unsigned long current_time)
+        {
+            if (!m_scheduling_waiting) return;
+            m_scheduling_waiting = false;
+            m_scheduling_delay += current_time - m_scheduling_wait_time;
+        }
+
         void P1Mini::ChangeState(enum states new_state)
         {
             unsigned long const current_time{ millis() };
+            if (new_state != states::PROCESSING_ASCII && new_state != states::PROCESSING_BINARY && new_state != states::PUBLISHING) ReleaseProcessing();
             switch (new_state) {
             case states::IDENTIFYING_MESSAGE:
                 m_identifying_message_time = current_time;
-                m_crc_position = m_message_buffer_position = 0;
-                m_num_message_loops = m_num_processing_loops = 0;
-                m_data_format = data_formats::UNKNOWN;
-                m_secondary_p1 = m_secondary_rts != nullptr && m_secondary_rts->state;
+                // What was received after the end of the last message starts this one
+                if (m_num_carried != 0) {
+                    ReleaseBuffer();
+                    std::memmove(m_message_buffer, m_message_buffer + m_received_position - m_num_carried, m_num_carried);
+                }
+                m_received_position = m_num_carried;
+                m_num_carried = 0;
+                ChangeBufferSize();
+                ClearMessage();
+                m_message_high_water_mark = m_received_position;
+                m_secondary_p1 = !m_secondary_replay && m_secondary_rts != nullptr && m_secondary_rts->state;
                 for (auto T : m_ready_to_receive_triggers) T->trigger();
                 break;
             case states::READING_MESSAGE:
@@ -448,20 +799,440 @@ namespace esphome {
                 m_processing_time = current_time;
                 m_start_of_data = m_message_buffer;
                 break;
+            case states::PUBLISHING:
+                m_publishing_time = current_time;
+                CommitSnapshot();
+                m_num_staged_published = 0;
+                break;
             case states::WAITING:
                 if (m_state != states::ERROR_RECOVERY) {
+                    if (m_data_format == data_formats::ASCII) std::swap(m_predicted_lines, m_next_predicted_lines);
+                    ++m_num_messages;
+                    m_total_lines += m_line_index;
+                    m_total_predicted_lines += m_num_predicted_lines;
+                    if (m_buffer_high_water_mark < m_message_high_water_mark) m_buffer_high_water_mark = m_message_high_water_mark;
+                    if (m_auto_buffer_size) LearnBufferSize(false);
                     m_display_time_stats = true;
+                    m_last_cycle.identifying_time = m_reading_message_time - m_identifying_message_time;
+                    m_last_cycle.message_time = m_processing_time - m_reading_message_time;
+                    m_last_cycle.processing_time = m_publishing_time - m_processing_time;
+                    m_last_cycle.publishing_time = current_time - m_publishing_time;
+                    m_last_cycle.message_loops = m_num_message_loops;
+                    m_last_cycle.processing_loops = m_num_processing_loops;
+                    m_last_cycle.publishing_loops = m_num_publishing_loops;
+                    m_last_cycle.message_length = m_message_length;
+                    m_last_cycle.num_published = m_num_published;
+                    m_last_cycle.num_predicted_lines = m_num_predicted_lines;
+                    m_last_cycle.num_lines = m_line_index;
+                    m_last_cycle.scheduling_delay = m_scheduling_delay;
                     for (auto T : m_update_processed_triggers) T->trigger();
                 }
+                m_scheduling_delay = 0;
                 m_waiting_time = current_time;
                 break;
             case states::ERROR_RECOVERY:
                 m_error_recovery_time = current_time;
+                ReleaseBuffer();
                 for (auto T : m_communication_error_triggers) T->trigger();
             }
             m_state = new_state;
         }
 
+        void P1Mini::ClearMessage()
+        {
+            m_crc_position = m_message_buffer_position = m_message_length = m_message_high_water_mark = 0;
+            m_staged_values.clear();
+            m_num_staged_texts = 0;
+            m_line_index = m_num_predicted_lines = 0;
+            m_next_predicted_lines.clear();
+            m_num_message_loops = m_num_processing_loops = m_num_publishing_loops = m_num_published = 0;
+            m_data_format = data_formats::UNKNOWN;
+        }
+
+        bool P1Mini::StartMessage(char first_byte)
+        {
+            if (first_byte == '/') {
+                ESP_LOGD(TAG, "ASCII data format");
+                m_data_format = data_formats::ASCII;
+                m_crc = crc16_update(crc16_ccitt_false_table, crc16_ccitt_false_init, first_byte);
+                return true;
+            }
+            if (first_byte == 0x7e) {
+                ESP_LOGD(TAG, "BINARY data format");
+                m_data_format = data_formats::BINARY;
+                m_crc = crc16_x25_init; // The starting flag is not included in the CRC
+                return true;
+            }
+            return false;
+        }
+
+        void P1Mini::Reset(enum errors error)
+        {
+            ++m_error_counts[static_cast<int>(error)];
+            m_num_carried = 0;
+            if (error == errors::BUFFER_OVERRUN && m_auto_buffer_size) LearnBufferSize(true);
+            if (!m_recovering) {
+                m_recovering = true;
+                m_error_time = millis();
+                m_num_failed_messages = 0;
+            }
+            if (m_data_format != data_formats::UNKNOWN) ++m_num_failed_messages;
+
+            // A timeout or unrequested data is not caused by a damaged message
+            if (m_fast_resync && error != errors::TIMEOUT && error != errors::UNREQUESTED_DATA && Resync(1)) return;
+            ChangeState(states::ERROR_RECOVERY);
+        }
+
+        int P1Mini::FindMessageStart(int from) const
+        {
+            // The next byte, if already received, must fit too: an ASCII message starts with
+            // the three letter manufacturer code and a binary frame with the frame format.
+            for (int i{ from }; i < m_received_position; ++i) {
+                uint8_t const byte{ static_cast<uint8_t>(m_message_buffer[i]) };
+                bool const has_next{ i + 1 < m_received_position };
+                uint8_t const next{ has_next ? static_cast<uint8_t>(m_message_buffer[i + 1]) : uint8_t{ 0 } };
+                if (byte == '/' && (!has_next || std::isalpha(next))) return i;
+                if (byte == 0x7e && (!has_next || next == 0x7e || (next & 0xe0) == 0xa0)) return i;
+            }
+            return -1;
+        }
+
+        bool P1Mini::Resync(int from)
+        {
+            int const start{ FindMessageStart(from) };
+            if (start < 0) return false;
+            ESP_LOGD(TAG, "Resynchronized %d bytes into the received data", start);
+            // Coming from error recovery, the error has already been reported
+            if (m_state != states::ERROR_RECOVERY) for (auto T : m_communication_error_triggers) T->trigger();
+
+            // Assemble the message from here, as if these bytes had just been received
+            ReleaseBuffer();
+            m_received_position -= start;
+            std::memmove(m_message_buffer, m_message_buffer + start, m_received_position);
+            // This is where the next message starts, so a buffer that overran is grown now
+            ChangeBufferSize();
+            ClearMessage();
+            StartMessage(m_message_buffer[0]);
+            m_message_buffer_position = 1;
+            if (m_message_high_water_mark < m_received_position) m_message_high_water_mark = m_received_position;
+            // The message was found right away, so the error is not counted as waiting for it
+            m_identifying_message_time = millis();
+            ChangeState(states::READING_MESSAGE);
+            return true;
+        }
+
+        void P1Mini::MessageVerified()
+        {
+            unsigned long const current_time{ millis() };
+            if (m_recovering) {
+                m_recovering = false;
+                m_recovery_time = current_time - m_error_time;
+                // When the meter sends at its own pace, messages missed while recovering are
+                // counted from the time since the last verified message.
+                int num_lost{ m_num_failed_messages };
+                if (m_period_ms == 0 && m_message_interval != 0 && m_verified_time != 0) {
+                    int const num_missed{ static_cast<int>((current_time - m_verified_time + m_message_interval / 2) / m_message_interval) - 1 };
+                    num_lost = std::max(num_lost, num_missed);
+                }
+                m_num_lost_messages += num_lost;
+                ESP_LOGI(TAG, "Recovered after %u ms, %d messages lost", m_recovery_time, num_lost);
+            }
+            else if (m_verified_time != 0) m_message_interval = current_time - m_verified_time;
+            m_verified_time = current_time;
+        }
+
+        void P1Mini::PublishDiagnostics()
+        {
+            unsigned long const current_time{ millis() };
+            auto publish = [](sensor::Sensor *sensor, float value) { if (sensor != nullptr) sensor->publish_state(value); };
+
+            // Times of the last complete cycle, the same as in the cycle times log line
+            if (m_num_messages != 0) {
+                publish(m_identifying_time_sensor, m_last_cycle.identifying_time);
+                publish(m_message_time_sensor, m_last_cycle.message_time);
+                publish(m_processing_time_sensor, m_last_cycle.processing_time);
+                publish(m_publishing_time_sensor, m_last_cycle.publishing_time);
+                publish(m_message_loops_sensor, m_last_cycle.message_loops);
+                publish(m_processing_loops_sensor, m_last_cycle.processing_loops);
+                publish(m_publishing_loops_sensor, m_last_cycle.publishing_loops);
+                publish(m_message_size_sensor, m_last_cycle.message_length);
+                publish(m_scheduling_delay_sensor, m_last_cycle.scheduling_delay);
+            }
+            if (m_total_lines != 0) publish(m_predicted_lines_sensor, 100.0f * m_total_predicted_lines / m_total_lines);
+            publish(m_longest_loop_sensor, m_longest_loop_time / 1000.0f);
+            publish(m_uart_backlog_sensor, m_uart_backlog);
+            publish(m_messages_per_minute_sensor, 60000.0f * m_num_messages / (current_time - m_diagnostics_time));
+            publish(m_crc_errors_sensor, m_error_counts[static_cast<int>(errors::CRC)]);
+            publish(m_buffer_overruns_sensor, m_error_counts[static_cast<int>(errors::BUFFER_OVERRUN)]);
+            publish(m_format_errors_sensor, m_error_counts[static_cast<int>(errors::FORMAT)]);
+            publish(m_timeouts_sensor, m_error_counts[static_cast<int>(errors::TIMEOUT)]);
+            publish(m_unrequested_data_sensor, m_error_counts[static_cast<int>(errors::UNREQUESTED_DATA)]);
+            publish(m_buffer_size_sensor, m_message_buffer_size);
+            publish(m_request_period_sensor, m_period_ms);
+            publish(m_lost_messages_sensor, m_num_lost_messages);
+            if (m_recovery_time != 0) publish(m_recovery_time_sensor, m_recovery_time);
+            if (m_buffer_high_water_mark != 0) publish(m_buffer_high_water_mark_sensor, m_buffer_high_water_mark);
+
+            // The rates and maximums are for the time since the last time they were published
+            m_diagnostics_time = current_time;
+            m_longest_loop_time = 0;
+            m_uart_backlog = 0;
+            m_num_messages = m_total_lines = m_total_predicted_lines = 0;
+        }
+
+        void P1Mini::register_sensor(IP1MiniSensor *sensor)
+        {
+            // Keep the table sorted on OBIS code so it can be binary searched. This is only done
+            // once per sensor during setup.
+            uint32_t const obis{ sensor->Obis() };
+            auto iter{ std::lower_bound(m_sensors.begin(), m_sensors.end(), obis, [](SensorEntry const &entry, uint32_t obis) { return entry.obis < obis; }) };
+            if (iter != m_sensors.end() && iter->obis == obis) {
+                ESP_LOGE(TAG, "More than one sensor with obis code %d.%d.%d", obis >> 16, (obis >> 8) & 0xff, obis & 0xff);
+                return;
+            }
+            m_sensors.insert(iter, { obis, sensor, {}, false, false, false });
+        }
+
+        IP1MiniSensor *P1Mini::FindSensor(uint32_t obis) const
+        {
+            SensorEntry const *const entry{ FindSensorEntry(obis) };
+            return entry != nullptr ? entry->sensor : nullptr;
+        }
+
+        P1Mini::SensorEntry const *P1Mini::FindSensorEntry(uint32_t obis) const
+        {
+            auto iter{ std::lower_bound(m_sensors.begin(), m_sensors.end(), obis, [](SensorEntry const &entry, uint32_t obis) { return entry.obis < obis; }) };
+            return iter != m_sensors.end() && iter->obis == obis ? &*iter : nullptr;
+        }
+
+        P1Mini::SensorEntry *P1Mini::FindSensorEntry(uint32_t obis)
+        {
+            auto iter{ std::lower_bound(m_sensors.begin(), m_sensors.end(), obis, [](SensorEntry const &entry, uint32_t obis) { return entry.obis < obis; }) };
+            return iter != m_sensors.end() && iter->obis == obis ? &*iter : nullptr;
+        }
+
+        void P1Mini::register_text_sensor(IP1MiniTextSensor *sensor)
+        {
+            // Sort on the first character, and long identifiers first among those with the
+            // same first character, so a line only needs to be compared with the identifiers
+            // that can match and the longest match is found first.
+            std::string const &identifier{ sensor->Identifier() };
+            if (identifier.empty()) return;
+            bool prefix_of_other{ false };
+            for (TextSensorEntry &entry : m_text_sensors) {
+                if (identifier.size() < entry.length && strncmp(entry.identifier, identifier.c_str(), identifier.size()) == 0) prefix_of_other = true;
+                if (entry.length < identifier.size() && strncmp(identifier.c_str(), entry.identifier, entry.length) == 0) entry.prefix_of_other = true;
+            }
+            auto iter{ m_text_sensors.begin() };
+            while (iter != m_text_sensors.end() && (iter->first < identifier[0] || (iter->first == identifier[0] && identifier.size() < iter->length))) ++iter;
+            m_text_sensors.insert(iter, { identifier[0], prefix_of_other, identifier.size(), identifier.c_str(), sensor });
+        }
+
+        P1Mini::TextSensorEntry const *P1Mini::FindTextSensor(char const *line) const
+        {
+            auto iter{ std::lower_bound(m_text_sensors.begin(), m_text_sensors.end(), *line, [](TextSensorEntry const &entry, char first) { return entry.first < first; }) };
+            for (; iter != m_text_sensors.end() && iter->first == *line; ++iter) {
+                if (strncmp(line, iter->identifier, iter->length) == 0) return &*iter;
+            }
+            return nullptr;
+        }
+
+        char *P1Mini::ProcessAsciiLine(char *start_of_line)
+        {
+            char *end_of_line{ start_of_line };
+            while (*end_of_line != '\n' && *end_of_line != '\r' && *end_of_line != '\0' && *end_of_line != '!') ++end_of_line;
+            char const end_of_line_char{ *end_of_line };
+            *end_of_line = '\0';
+
+            if (end_of_line != start_of_line) {
+                int minor{ -1 }, major{ -1 }, micro{ -1 };
+                P1MiniValue value;
+                bool const is_regular_sensor{ ParseLine(start_of_line, major, minor, micro, value) };
+                uint32_t const obis{ is_regular_sensor ? OBIS(major, minor, micro) : OBIS_NONE };
+
+                // A meter sends the lines in the same order every time, so first check if the line
+                // matches the sensor that was found on the same line in the previous message.
+                LineMatch match{ obis, nullptr, nullptr };
+                LineMatch const *const predicted{ m_line_index < m_predicted_lines.size() ? &m_predicted_lines[m_line_index] : nullptr };
+                if (predicted != nullptr && predicted->obis == obis && predicted->sensor != nullptr) {
+                    match.sensor = predicted->sensor;
+                    ++m_num_predicted_lines;
+                }
+                else if (predicted != nullptr && is_regular_sensor && predicted->obis == obis && predicted->text == nullptr) {
+                    // The line with this OBIS code matched nothing last time, so it will not now.
+                    // Other lines are identified by their text, so they are still searched for.
+                    ++m_num_predicted_lines;
+                }
+                else if (predicted != nullptr && predicted->obis == obis && predicted->text != nullptr && !predicted->text->prefix_of_other
+                    && strncmp(start_of_line, predicted->text->identifier, predicted->text->length) == 0) {
+                    match.text = predicted->text;
+                    ++m_num_predicted_lines;
+                }
+                else {
+                    if (is_regular_sensor) match.sensor = FindSensor(obis);
+                    if (match.sensor == nullptr) match.text = FindTextSensor(start_of_line);
+                }
+                ++m_line_index;
+                if (m_next_predicted_lines.size() < max_predicted_lines) m_next_predicted_lines.push_back(match);
+
+                if (match.sensor != nullptr) StageValue(match.sensor, value);
+                else if (match.text != nullptr) StageText(match.text->sensor, start_of_line, end_of_line - start_of_line);
+                else {
+                    if (is_regular_sensor)
+                        ESP_LOGD(TAG, "No sensor matched line '%s' with obis code %d.%d.%d", start_of_line, major, minor, micro);
+                    else
+                        ESP_LOGD(TAG, "No sensor matched line '%s'", start_of_line);
+                }
+            }
+            *end_of_line = end_of_line_char;
+            return end_of_line;
+        }
+
+        bool P1Mini::ProcessCachedBinaryLayout()
+        {
+            // A meter sends the same layout every time, so when the message has the same length
+            // and every value is still preceded by the same OBIS code, the values can be read
+            // directly from where they were found in the previous message.
+            if (m_binary_layout_length == 0 || m_binary_layout_length != m_crc_position) return false;
+            for (BinaryLayoutEntry const &entry : m_binary_layout) {
+                uint8_t const *const obis{ reinterpret_cast<uint8_t const *>(m_message_buffer + entry.obis_offset) };
+                if (obis[0] != 0x09 || obis[1] != 0x06 || OBIS(obis[4], obis[5], obis[6]) != entry.obis) return false;
+                if (static_cast<uint8_t>(m_message_buffer[entry.value_offset]) != entry.type) return false;
+            }
+            for (BinaryLayoutEntry const &entry : m_binary_layout) {
+                StageValue(entry.sensor, BinaryValue(m_message_buffer + entry.value_offset));
+            }
+            return true;
+        }
+
+        void P1Mini::PublishValue(IP1MiniSensor *sensor, P1MiniValue value)
+        {
+            if (m_aggregator != nullptr) m_aggregator->AddValue(sensor->Obis(), value);
+            if (!m_publish_sensors) {
+                // The values in the snapshot are only published there
+                SensorEntry const *const entry{ FindSensorEntry(sensor->Obis()) };
+                if (entry != nullptr && entry->in_snapshot) return;
+            }
+            if (!sensor->ShouldPublish(value, millis())) return;
+            sensor->publish_val(value);
+            ++m_num_published;
+        }
+
+        void P1Mini::StageValue(IP1MiniSensor *sensor, P1MiniValue value)
+        {
+            // At most one value per sensor is expected in a message, so the capacity reserved
+            // here is never exceeded and the vector is not reallocated while streaming.
+            if (m_staged_values.capacity() < m_sensors.size()) m_staged_values.reserve(m_sensors.size());
+            if (m_staged_values.size() == m_sensors.size()) return;
+            m_staged_values.push_back({ sensor, value });
+        }
+
+        void P1Mini::CommitSnapshot()
+        {
+            if (m_adaptive_period) {
+                float largest_change{ 0.0f };
+                for (StagedValue const &staged : m_staged_values) {
+                    SensorEntry const *const entry{ FindSensorEntry(staged.sensor->Obis()) };
+                    if (entry == nullptr || !entry->adaptive || !entry->has_value) continue;
+                    largest_change = std::max(largest_change, std::fabs(staged.value.ToFloat() - entry->value.ToFloat()));
+                }
+                UpdatePeriod(largest_change);
+            }
+
+            // Only the values of the last message are in the snapshot
+            for (SensorEntry &entry : m_sensors) entry.has_value = false;
+            for (StagedValue const &staged : m_staged_values) {
+                SensorEntry *const entry{ FindSensorEntry(staged.sensor->Obis()) };
+                if (entry == nullptr) continue;
+                entry->value = staged.value;
+                entry->has_value = true;
+            }
+#ifdef USE_P1_MINI_HISTORY
+            if (m_history != nullptr) m_history->AddSample(*this);
+#endif
+        }
+
+        void P1Mini::PublishSnapshot()
+        {
+            // Built straight from the values, reusing the capacity of the string between messages
+            m_snapshot.clear();
+            m_snapshot += '{';
+            char text[32];
+            for (SensorEntry const &entry : m_sensors) {
+                if (!entry.in_snapshot || !entry.has_value) continue;
+                if (m_snapshot.size() > 1) m_snapshot += ',';
+                m_snapshot.append(text, snprintf(text, sizeof(text), "\"%u.%u.%u\":", entry.obis >> 16, (entry.obis >> 8) & 0xff, entry.obis & 0xff));
+                m_snapshot.append(text, entry.value.Format(text, sizeof(text)));
+            }
+            m_snapshot += '}';
+            m_snapshot_sensor->publish_state(m_snapshot);
+            ++m_num_published;
+        }
+
+        void P1Mini::UpdatePeriod(float largest_change)
+        {
+            uint32_t period_ms{ m_period_ms };
+            if (largest_change >= m_adaptive_threshold) period_ms = m_min_period_ms;
+            else if (largest_change < m_adaptive_threshold - m_adaptive_hysteresis) {
+                // Back off gradually, so a change is still caught reasonably soon
+                constexpr uint32_t min_step_ms{ 1000 };
+                period_ms = std::min(std::max(m_period_ms * 2, min_step_ms), m_max_period_ms);
+            }
+            if (period_ms != m_period_ms) {
+                ESP_LOGD(TAG, "Request period changed to %u ms (largest change %.3f)", period_ms, largest_change);
+                m_period_ms = period_ms;
+            }
+        }
+
+        float P1Mini::get_value(int major, int minor, int micro) const
+        {
+            SensorEntry const *const entry{ FindSensorEntry(OBIS(major, minor, micro)) };
+            return entry != nullptr && entry->has_value ? entry->value.ToFloat() : NAN;
+        }
+
+        bool P1Mini::get_snapshot_value(uint32_t obis, P1MiniValue &value) const
+        {
+            SensorEntry const *const entry{ FindSensorEntry(obis) };
+            if (entry == nullptr || !entry->has_value) return false;
+            value = entry->value;
+            return true;
+        }
+
+        float P1Mini::get_value(char const *obis_code) const
+        {
+            // The last three numbers, so both "1.8.0" and "1-0:1.8.0" work
+            int numbers[3]{ -1, -1, -1 };
+            for (char const *position{ obis_code }; *position != '\0';) {
+                if (*position < '0' || *position > '9') {
+                    ++position;
+                    continue;
+                }
+                numbers[0] = numbers[1];
+                numbers[1] = numbers[2];
+                numbers[2] = static_cast<int>(strtol(position, const_cast<char **>(&position), 10));
+            }
+            if (numbers[0] < 0) return NAN;
+            return get_value(numbers[0], numbers[1], numbers[2]);
+        }
+
+        void P1Mini::StageText(IP1MiniTextSensor *sensor, char const *value, size_t length)
+        {
+            // The strings are kept between messages and reassigned to avoid reallocating
+            if (m_staged_texts.size() < m_text_sensors.size()) m_staged_texts.resize(m_text_sensors.size());
+            if (m_num_staged_texts == m_staged_texts.size()) return;
+            StagedText &staged{ m_staged_texts[m_num_staged_texts++] };
+            staged.sensor = sensor;
+            staged.value.assign(value, length);
+        }
+
+        int P1Mini::BytesPerSecond() const
+        {
+            // Rate at which the message arrived, from the first to the last byte. Mostly
+            // limited by the baud rate, but drops if loop() is not called often enough.
+            if (m_last_cycle.message_time == 0) return 0;
+            return static_cast<int>(m_last_cycle.message_length * 1000UL / m_last_cycle.message_time);
+        }
+
         void P1Mini::AddByteToDiscardLog(uint8_t byte)
         {
             constexpr char hex_chars[] = "0123456789abcdef";
@@ -482,6 +1253,24 @@ namespace esphome {
 
         void P1Mini::dump_config() {
             ESP_LOGCONFIG(TAG, "P1 Mini component");
+            ESP_LOGCONFIG(TAG, "  Buffer size: %d bytes%s", m_message_buffer_size, m_auto_buffer_size ? " (auto)" : "");
+            if (m_streaming) ESP_LOGCONFIG(TAG, "  Streaming ASCII messages");
+            if (m_fast_resync) ESP_LOGCONFIG(TAG, "  Fast resync after errors");
+            if (m_snapshot_sensor != nullptr) ESP_LOGCONFIG(TAG, "  Publishing a snapshot of each message%s", m_publish_sensors ? "" : " instead of the sensors");
+            if (s_instances.size() > 1) ESP_LOGCONFIG(TAG, "  Sharing processing time with %d other instances", static_cast<int>(s_instances.size()) - 1);
+            if (m_secondary_replay) ESP_LOGCONFIG(TAG, "  Replaying messages to the secondary port");
+            if (m_adaptive_period) ESP_LOGCONFIG(TAG, "  Adaptive period: %u to %u ms, threshold %.3f, hysteresis %.3f", m_min_period_ms, m_max_period_ms, m_adaptive_threshold, m_adaptive_hysteresis);
+            ESP_LOGCONFIG(TAG, "  Publish budget: %d ms per loop", m_publish_budget_ms);
+#ifdef USE_P1_MINI_READER_TASK
+            if (m_ring) ESP_LOGCONFIG(TAG, "  Reading in a separate task");
+#endif
+            if (m_aggregator != nullptr) m_aggregator->dump_config();
+#ifdef USE_P1_MINI_TCP_SERVER
+            if (m_tcp_server != nullptr) m_tcp_server->dump_config();
+#endif
+#ifdef USE_P1_MINI_HISTORY
+            if (m_history != nullptr) m_history->dump_config();
+#endif
         }
 
     }  // namespace p1_mini
@@ -3,44 +3,99 @@
 #include "esphome/core/component.h"
 #include "esphome/components/uart/uart.h"
 #include "esphome/components/binary_sensor/binary_sensor.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/text_sensor/text_sensor.h"
 #include "esphome/core/automation.h"
 
-#include <map>
+#include <vector>
+
+#ifdef USE_P1_MINI_READER_TASK
+#include "p1_mini_ring.h"
+#endif
+#ifdef USE_P1_MINI_TCP_SERVER
+#include "p1_mini_tcp_server.h"
+#endif
 
 namespace esphome {
     namespace p1_mini {
 
 
+        // A value as received from the meter, kept as an integer and the number of decimals
+        // to avoid floating point math (done in software on the ESP8266 and ESP32-C3) until
+        // the value is published.
+        struct P1MiniValue
+        {
+            constexpr static uint8_t max_decimals{ 9 };
+            int32_t mantissa{ 0 };
+            uint8_t decimals{ 0 };
+
+            float ToFloat() const;
+            // Exact decimal text, as received from the meter without leading zeros
+            int Format(char *text, size_t size) const;
+        };
+
         class IP1MiniSensor
         {
         public:
             virtual ~IP1MiniSensor() = default;
-            virtual void publish_val(double) = 0;
+            virtual void publish_val(P1MiniValue) = 0;
             virtual uint32_t Obis() const = 0;
+            // Called before publish_val to apply the publish policy of the sensor
+            virtual bool ShouldPublish(P1MiniValue value, uint32_t now) = 0;
         };
 
         class P1MiniSensorBase : public IP1MiniSensor
         {
             uint32_t const m_obis;
+
+            // Publish policy, and the last published value it is checked against
+            bool m_publish_on_change{ false };
+            bool m_has_published{ false };
+            uint8_t m_delta_decimals{ 0xff };
+            float m_delta{ 0.0f };
+            int64_t m_delta_mantissa{ 0 };
+            uint32_t m_max_interval_ms{ 0 };
+            uint32_t m_last_publish_time{ 0 };
+            P1MiniValue m_last_value;
         public:
-            P1MiniSensorBase(std::string obis_code);
+            // The OBIS code is packed by the code generation, see obis_code() in __init__.py
+            P1MiniSensorBase(uint32_t obis_code) : m_obis{ obis_code } {}
             virtual uint32_t Obis() const { return m_obis; }
+
+            void set_publish_on_change(bool publish_on_change) { m_publish_on_change = publish_on_change; }
+            void set_delta(float delta) { m_delta = delta; }
+            void set_max_interval(uint32_t max_interval_ms) { m_max_interval_ms = max_interval_ms; }
+
+            virtual bool ShouldPublish(P1MiniValue value, uint32_t now) override;
         };
 
         class IP1MiniTextSensor
         {
         public:
             virtual ~IP1MiniTextSensor() = default;
-            virtual void publish_val(std::string) = 0;
-            virtual std::string Identifier() const = 0;
+            // The value is not null terminated. Returns false when the value is the same as last
+            // time and was not published.
+            virtual bool publish_val(char const *value, size_t length) = 0;
+            virtual std::string const &Identifier() const = 0;
         };
 
         class P1MiniTextSensorBase : public IP1MiniTextSensor
         {
             std::string const m_identifier;
+        protected:
+            std::string m_last_value;
         public:
             P1MiniTextSensorBase(std::string identifier);
-            virtual std::string Identifier() const { return m_identifier; }
+            virtual std::string const &Identifier() const { return m_identifier; }
+
+            // Keeps a copy of the last value, reusing its memory, to be able to skip publishing
+            // values that have not changed.
+            bool UpdateLastValue(char const *value, size_t length)
+            {
+                if (m_last_value.size() == length && m_last_value.compare(0, length, value, length) == 0) return false;
+                m_last_value.assign(value, length);
+                return true;
+            }
         };
 
         class ReadyToReceiveTrigger : public Trigger<> { };
@@ -49,26 +104,26 @@ namespace esphome {
         class UpdateProcessedTrigger : public Trigger<> { };
         class CommunicationErrorTrigger : public Trigger<> { };
 
+        class P1MiniAggregator;
+        class P1MiniHistory;
+
         class P1Mini : public uart::UARTDevice, public Component {
         public:
-            P1Mini(uint32_t min_period_ms, int buffer_size);
+            P1Mini(uint32_t min_period_ms, int buffer_size); // buffer_size 0 for automatic
 
             void setup() override;
             void loop() override;
             void dump_config() override;
 
-            void register_sensor(IP1MiniSensor *sensor)
-            {
-                m_sensors.emplace(sensor->Obis(), sensor);
-            }
+            void register_sensor(IP1MiniSensor *sensor);
 
-            void register_text_sensor(IP1MiniTextSensor *sensor)
-            {
-                // Sort long identifiers first in the vector
-                auto iter{ m_text_sensors.begin() };
-                while (iter != m_text_sensors.end() && sensor->Identifier().size() < (*iter)->Identifier().size()) ++iter;
-                m_text_sensors.insert(iter, sensor);
-            }
+            void register_text_sensor(IP1MiniTextSensor *sensor);
+
+            // Value of a registered sensor in the last complete message, for use in lambdas.
+            // NAN if the sensor had no value in that message.
+            float get_value(char const *obis_code) const;
+            float get_value(int major, int minor, int micro) const;
+            bool get_snapshot_value(uint32_t obis, P1MiniValue &value) const;
 
             void register_ready_to_receive_trigger(ReadyToReceiveTrigger *trigger) { m_ready_to_receive_triggers.push_back(trigger); }
             void register_receiving_update_trigger(ReceivingUpdateTrigger *trigger) { m_receiving_update_triggers.push_back(trigger); }
@@ -77,6 +132,56 @@ namespace esphome {
             void register_communication_error_trigger(CommunicationErrorTrigger *trigger) { m_communication_error_triggers.push_back(trigger); }
 
             void set_secondary_rts(binary_sensor::BinarySensor *sensor) { m_secondary_rts = sensor; }
+            void set_secondary_replay(bool replay) { m_secondary_replay = replay; }
+            void set_adaptive_period(uint32_t max_period_ms, float threshold, float hysteresis)
+            {
+                m_adaptive_period = true;
+                m_max_period_ms = max_period_ms;
+                m_adaptive_threshold = threshold;
+                m_adaptive_hysteresis = hysteresis;
+            }
+            void add_adaptive_obis_code(uint32_t obis) { m_adaptive_obis_codes.push_back(obis); }
+            void set_streaming(bool streaming) { m_streaming = streaming; }
+            void set_fast_resync(bool fast_resync) { m_fast_resync = fast_resync; }
+            void set_snapshot_sensor(text_sensor::TextSensor *sensor) { m_snapshot_sensor = sensor; }
+            void add_snapshot_obis_code(uint32_t obis) { m_snapshot_obis_codes.push_back(obis); }
+            void set_publish_sensors(bool publish) { m_publish_sensors = publish; }
+            void set_publish_budget(uint32_t budget_ms) { m_publish_budget_ms = budget_ms; }
+#ifdef USE_P1_MINI_READER_TASK
+            void set_reader_task(bool reader_task) { m_reader_task = reader_task; }
+#endif
+            void set_aggregator(P1MiniAggregator *aggregator) { m_aggregator = aggregator; }
+#ifdef USE_P1_MINI_TCP_SERVER
+            void set_tcp_server(P1MiniTcpServer *server) { m_tcp_server = server; }
+#endif
+#ifdef USE_P1_MINI_HISTORY
+            void set_history(P1MiniHistory *history) { m_history = history; }
+#endif
+
+            void set_diagnostics_interval(uint32_t interval_ms) { m_diagnostics_interval_ms = interval_ms; }
+            void set_identifying_time_sensor(sensor::Sensor *sensor) { m_identifying_time_sensor = sensor; }
+            void set_message_time_sensor(sensor::Sensor *sensor) { m_message_time_sensor = sensor; }
+            void set_processing_time_sensor(sensor::Sensor *sensor) { m_processing_time_sensor = sensor; }
+            void set_publishing_time_sensor(sensor::Sensor *sensor) { m_publishing_time_sensor = sensor; }
+            void set_message_loops_sensor(sensor::Sensor *sensor) { m_message_loops_sensor = sensor; }
+            void set_processing_loops_sensor(sensor::Sensor *sensor) { m_processing_loops_sensor = sensor; }
+            void set_publishing_loops_sensor(sensor::Sensor *sensor) { m_publishing_loops_sensor = sensor; }
+            void set_message_size_sensor(sensor::Sensor *sensor) { m_message_size_sensor = sensor; }
+            void set_predicted_lines_sensor(sensor::Sensor *sensor) { m_predicted_lines_sensor = sensor; }
+            void set_longest_loop_sensor(sensor::Sensor *sensor) { m_longest_loop_sensor = sensor; }
+            void set_messages_per_minute_sensor(sensor::Sensor *sensor) { m_messages_per_minute_sensor = sensor; }
+            void set_crc_errors_sensor(sensor::Sensor *sensor) { m_crc_errors_sensor = sensor; }
+            void set_buffer_overruns_sensor(sensor::Sensor *sensor) { m_buffer_overruns_sensor = sensor; }
+            void set_format_errors_sensor(sensor::Sensor *sensor) { m_format_errors_sensor = sensor; }
+            void set_timeouts_sensor(sensor::Sensor *sensor) { m_timeouts_sensor = sensor; }
+            void set_unrequested_data_sensor(sensor::Sensor *sensor) { m_unrequested_data_sensor = sensor; }
+            void set_buffer_size_sensor(sensor::Sensor *sensor) { m_buffer_size_sensor = sensor; }
+            void set_buffer_high_water_mark_sensor(sensor::Sensor *sensor) { m_buffer_high_water_mark_sensor = sensor; }
+            void set_request_period_sensor(sensor::Sensor *sensor) { m_request_period_sensor = sensor; }
+            void set_lost_messages_sensor(sensor::Sensor *sensor) { m_lost_messages_sensor = sensor; }
+            void set_recovery_time_sensor(sensor::Sensor *sensor) { m_recovery_time_sensor = sensor; }
+            void set_scheduling_delay_sensor(sensor::Sensor *sensor) { m_scheduling_delay_sensor = sensor; }
+            void set_uart_backlog_sensor(sensor::Sensor *sensor) { m_uart_backlog_sensor = sensor; }
 
         private:
 
@@ -84,44 +189,252 @@ namespace esphome {
             unsigned long m_reading_message_time{ 0 };
             unsigned long m_verifying_crc_time{ 0 };
             unsigned long m_processing_time{ 0 };
+            unsigned long m_publishing_time{ 0 };
             unsigned long m_waiting_time{ 0 };
             unsigned long m_error_recovery_time{ 0 };
             int m_num_message_loops{ 0 };
             int m_num_processing_loops{ 0 };
+            int m_num_publishing_loops{ 0 };
+            int m_num_published{ 0 };
             bool m_display_time_stats{ false };
             uint32_t m_time_stats_as_info_next{ 4 }; // 0 to disable
             uint32_t m_time_stats_counter{ 0 };
             uint32_t m_obis_code{ 0 };
+            uint16_t m_obis_code_offset{ 0 };
+
+            P1MiniAggregator *m_aggregator{ nullptr };
+#ifdef USE_P1_MINI_TCP_SERVER
+            P1MiniTcpServer *m_tcp_server{ nullptr };
+#endif
+#ifdef USE_P1_MINI_HISTORY
+            P1MiniHistory *m_history{ nullptr };
+#endif
+            // Called before anything is written to the message buffer
+            void ReleaseBuffer()
+            {
+#ifdef USE_P1_MINI_TCP_SERVER
+                if (m_tcp_server != nullptr) m_tcp_server->Release();
+#endif
+            }
+
+            // Diagnostics, published with a fixed interval
+            uint32_t m_diagnostics_interval_ms{ 0 }; // 0 to disable
+            unsigned long m_diagnostics_time{ 0 };
+            uint32_t m_longest_loop_time{ 0 }; // us
+            int m_uart_backlog{ 0 }; // Most bytes waiting to be read while reading a message
+            int m_num_messages{ 0 };
+            int m_total_lines{ 0 };
+            int m_total_predicted_lines{ 0 };
+            sensor::Sensor *m_identifying_time_sensor{ nullptr };
+            sensor::Sensor *m_message_time_sensor{ nullptr };
+            sensor::Sensor *m_processing_time_sensor{ nullptr };
+            sensor::Sensor *m_publishing_time_sensor{ nullptr };
+            sensor::Sensor *m_message_loops_sensor{ nullptr };
+            sensor::Sensor *m_processing_loops_sensor{ nullptr };
+            sensor::Sensor *m_publishing_loops_sensor{ nullptr };
+            sensor::Sensor *m_message_size_sensor{ nullptr };
+            sensor::Sensor *m_predicted_lines_sensor{ nullptr };
+            sensor::Sensor *m_longest_loop_sensor{ nullptr };
+            sensor::Sensor *m_messages_per_minute_sensor{ nullptr };
+            sensor::Sensor *m_crc_errors_sensor{ nullptr };
+            sensor::Sensor *m_buffer_overruns_sensor{ nullptr };
+            sensor::Sensor *m_format_errors_sensor{ nullptr };
+            sensor::Sensor *m_timeouts_sensor{ nullptr };
+            sensor::Sensor *m_unrequested_data_sensor{ nullptr };
+            sensor::Sensor *m_buffer_size_sensor{ nullptr };
+            sensor::Sensor *m_buffer_high_water_mark_sensor{ nullptr };
+            sensor::Sensor *m_request_period_sensor{ nullptr };
+            sensor::Sensor *m_lost_messages_sensor{ nullptr };
+            sensor::Sensor *m_recovery_time_sensor{ nullptr };
+            sensor::Sensor *m_scheduling_delay_sensor{ nullptr };
+            sensor::Sensor *m_uart_backlog_sensor{ nullptr };
+            void PublishDiagnostics();
+
+            // Copied from the cycle when it completes, so the diagnostics, which are published
+            // at any time, never see the times and counts of a cycle in progress or one that
+            // ended in an error.
+            struct CycleStats {
+                uint32_t identifying_time{ 0 };
+                uint32_t message_time{ 0 };
+                uint32_t processing_time{ 0 };
+                uint32_t publishing_time{ 0 };
+                uint32_t scheduling_delay{ 0 };
+                int message_loops{ 0 };
+                int processing_loops{ 0 };
+                int publishing_loops{ 0 };
+                int message_length{ 0 };
+                int num_published{ 0 };
+                int num_predicted_lines{ 0 };
+                int num_lines{ 0 };
+            };
+            CycleStats m_last_cycle;
 
             // Store the message as it is being received:
-            std::unique_ptr<char> m_message_buffer_UP;
-            int m_message_buffer_size;
+            std::unique_ptr<char[]> m_message_buffer_UP;
+            int m_message_buffer_size{ 0 };
             char *m_message_buffer{ nullptr };
-            int m_message_buffer_position{ 0 };
+            int m_message_buffer_position{ 0 }; // Bytes up to here have been processed
+            int m_received_position{ 0 }; // Bytes up to here have been read from the UART
+            int m_num_carried{ 0 }; // Received after the end of the verified message, kept for the next one
+            int m_message_length{ 0 }; // Differs from the buffer position when streaming
             int m_crc_position{ 0 };
+            uint16_t m_crc{ 0 }; // Calculated while the message is received
+            bool AllocateBuffer(int size);
+
+            // Most of the buffer used by any message, and by the current one
+            int m_buffer_high_water_mark{ 0 };
+            int m_message_high_water_mark{ 0 };
+
+            // With automatic buffer size, the buffer is fitted to the size of the first few
+            // messages and grown if a message does not fit. It is only reallocated between
+            // messages.
+            constexpr static int auto_buffer_initial_size{ 1024 };
+            constexpr static int auto_buffer_max_size{ 32768 };
+            constexpr static int auto_buffer_learn_messages{ 4 };
+            bool const m_auto_buffer_size;
+            int m_new_buffer_size{ 0 }; // Size to change to before the next message, 0 for none
+            int m_num_learned_messages{ 0 };
+            int m_learned_size{ 0 };
+            void LearnBufferSize(bool overrun);
+            void ChangeBufferSize();
 
             // Keeps track of the start of the data record while processing.
             char *m_start_of_data;
 
+            // The values are kept here until the whole message has been processed, and then
+            // published a few at a time. When streaming, the lines of ASCII messages are
+            // processed as they are received.
+            bool m_streaming{ false };
+            uint32_t m_publish_budget_ms{ 10 };
+            struct StagedValue {
+                IP1MiniSensor *sensor;
+                P1MiniValue value;
+            };
+            struct StagedText {
+                IP1MiniTextSensor *sensor;
+                std::string value;
+            };
+            std::vector<StagedValue> m_staged_values;
+            std::vector<StagedText> m_staged_texts;
+            size_t m_num_staged_texts{ 0 };
+            size_t m_num_staged_published{ 0 };
+
+            // Where the values of the registered sensors were found in the last binary message
+            struct BinaryLayoutEntry {
+                uint32_t obis;
+                uint16_t obis_offset;
+                uint16_t value_offset;
+                uint8_t type;
+                IP1MiniSensor *sensor;
+            };
+            std::vector<BinaryLayoutEntry> m_binary_layout;
+            int m_binary_layout_length{ 0 }; // 0 if no layout has been learned
+            bool ProcessCachedBinaryLayout();
+
+            char *ProcessAsciiLine(char *start_of_line);
+            void PublishValue(IP1MiniSensor *sensor, P1MiniValue value);
+            void StageValue(IP1MiniSensor *sensor, P1MiniValue value);
+            void StageText(IP1MiniTextSensor *sensor, char const *value, size_t length);
+            void CommitSnapshot();
+
+            // All values of a message in one compact JSON text, keyed by OBIS code
+            text_sensor::TextSensor *m_snapshot_sensor{ nullptr };
+            std::vector<uint32_t> m_snapshot_obis_codes; // All sensors if empty
+            bool m_publish_sensors{ true }; // The sensors for the values are also published
+            std::string m_snapshot;
+            void PublishSnapshot();
+
             char GetByte()
             {
-                char const C{ static_cast<char>(read()) };
+                uint8_t C{ 0 };
+                ReadArray(&C, 1);
                 if (m_secondary_p1) write(C);
-                return C;
+                return static_cast<char>(C);
+            }
+
+            // Received data comes from the UART, or from the ring filled by the reader task
+            int Available()
+            {
+#ifdef USE_P1_MINI_READER_TASK
+                if (m_ring) return static_cast<int>(m_ring->Available());
+#endif
+                return available();
+            }
+            void ReadArray(uint8_t *data, int length)
+            {
+#ifdef USE_P1_MINI_READER_TASK
+                if (m_ring) {
+                    m_ring->Read(data, length);
+                    return;
+                }
+#endif
+                read_array(data, length);
             }
 
+#ifdef USE_P1_MINI_READER_TASK
+            // Moves data from the UART to the ring, so nothing is lost when loop() is delayed
+            bool m_reader_task{ false };
+            std::unique_ptr<P1MiniRing> m_ring;
+            static void ReaderTask(void *param);
+#endif
+
             enum class states {
                 IDENTIFYING_MESSAGE,
                 READING_MESSAGE,
                 VERIFYING_CRC,
                 PROCESSING_ASCII,
                 PROCESSING_BINARY,
+                PUBLISHING,
                 WAITING,
                 ERROR_RECOVERY
             };
             enum states m_state { states::ERROR_RECOVERY };
 
             void ChangeState(enum states new_state);
+            void RunStateMachine();
+
+            // Shared by all instances. With more than one meter, only one message at a time is
+            // processed and published, so the instances never use up the time of the same loop
+            // together, and meters controlled by RTS are asked for messages one at a time.
+            static std::vector<P1Mini *> s_instances;
+            static P1Mini *s_processing_instance;
+            constexpr static uint32_t max_identifying_wait_ms{ 1500 }; // A meter that does not answer is not waited for
+            bool AcquireProcessing(unsigned long current_time);
+            void ReleaseProcessing();
+            bool OtherMeterSending(unsigned long current_time) const;
+            bool m_scheduling_waiting{ false };
+            unsigned long m_scheduling_wait_time{ 0 }; // When waiting for another instance started
+            uint32_t m_scheduling_delay{ 0 }; // Time spent waiting for other instances during the current message
+            void StartSchedulingWait(unsigned long current_time);
+            void EndSchedulingWait(unsigned long current_time);
+
+            // Reasons for going to the ERROR_RECOVERY state
+            enum class errors {
+                CRC,
+                BUFFER_OVERRUN,
+                FORMAT,
+                TIMEOUT,
+                UNREQUESTED_DATA,
+                NUM_ERRORS
+            };
+            uint32_t m_error_counts[static_cast<int>(errors::NUM_ERRORS)]{};
+            void Reset(enum errors error);
+
+            // With fast resync, the bytes already received are searched for the start of the next
+            // message after an error, instead of waiting for the line to go quiet.
+            bool m_fast_resync{ false };
+            int FindMessageStart(int from) const;
+            bool Resync(int from);
+
+            // From the first error until the next verified message
+            bool m_recovering{ false };
+            unsigned long m_error_time{ 0 };
+            int m_num_failed_messages{ 0 }; // Messages started but not verified since the first error
+            unsigned long m_verified_time{ 0 }; // Of the last verified message
+            uint32_t m_message_interval{ 0 }; // Between the last two verified messages without errors
+            uint32_t m_num_lost_messages{ 0 };
+            uint32_t m_recovery_time{ 0 };
+            void MessageVerified();
 
             enum class data_formats {
                 UNKNOWN,
@@ -129,13 +442,67 @@ namespace esphome {
                 BINARY
             };
             enum data_formats m_data_format { data_formats::UNKNOWN };
+            bool StartMessage(char first_byte);
+            void ClearMessage();
 
             uint32_t const m_min_period_ms;
+
+            // With an adaptive period, messages are requested every minimum period while the
+            // watched values change quickly, and less and less often while they are steady.
+            uint32_t m_period_ms;
+            bool m_adaptive_period{ false };
+            uint32_t m_max_period_ms{ 0 };
+            float m_adaptive_threshold{ 0.0f };
+            float m_adaptive_hysteresis{ 0.0f };
+            std::vector<uint32_t> m_adaptive_obis_codes;
+            void UpdatePeriod(float largest_change);
             bool m_secondary_p1{ false };
             binary_sensor::BinarySensor *m_secondary_rts{ nullptr };
 
-            std::map<uint32_t, IP1MiniSensor *> m_sensors;
-            std::vector<IP1MiniTextSensor *> m_text_sensors; // Keep sorted so longer identifiers are first!
+            // In replay mode, the last verified message is sent to the secondary port whenever
+            // it asks for data, instead of passing on the data as it is received.
+            bool m_secondary_replay{ false };
+            bool m_secondary_rts_state{ false };
+            std::vector<uint8_t> m_replay_buffer;
+            size_t m_replay_position{ 0 }; // Sent up to here, the size of the buffer when done
+            void CacheForReplay();
+            void Replay();
+
+            // Sorted on OBIS code, with the values of the last complete message
+            struct SensorEntry {
+                uint32_t obis;
+                IP1MiniSensor *sensor;
+                P1MiniValue value;
+                bool has_value;
+                bool adaptive; // Decides the period with an adaptive period
+                bool in_snapshot;
+            };
+            std::vector<SensorEntry> m_sensors;
+            IP1MiniSensor *FindSensor(uint32_t obis) const;
+            SensorEntry const *FindSensorEntry(uint32_t obis) const;
+            SensorEntry *FindSensorEntry(uint32_t obis);
+            struct TextSensorEntry {
+                char first;
+                bool prefix_of_other; // Another identifier starts with this one
+                size_t length;
+                char const *identifier; // Owned by the sensor
+                IP1MiniTextSensor *sensor;
+            };
+            std::vector<TextSensorEntry> m_text_sensors; // Keep sorted on first character, then longer identifiers first!
+            TextSensorEntry const *FindTextSensor(char const *line) const;
+
+            // The sensors matched by each line of the last ASCII message, used to predict which
+            // sensor the same line in the next message will match.
+            struct LineMatch {
+                uint32_t obis;
+                IP1MiniSensor *sensor;
+                TextSensorEntry const *text;
+            };
+            constexpr static size_t max_predicted_lines{ 128 };
+            std::vector<LineMatch> m_predicted_lines;
+            std::vector<LineMatch> m_next_predicted_lines;
+            size_t m_line_index{ 0 };
+            int m_num_predicted_lines{ 0 };
             
             std::vector<ReadyToReceiveTrigger *> m_ready_to_receive_triggers;
             std::vector<ReceivingUpdateTrigger *> m_receiving_update_triggers;
@@ -148,6 +515,8 @@ namespace esphome {
             char *m_discard_log_position{ m_discard_log_buffer };
             char *const m_discard_log_end{ m_discard_log_buffer + (discard_log_num_bytes * 2) };
 
+            int BytesPerSecond() const;
+
             void AddByteToDiscardLog(uint8_t byte);
             void FlushDiscardLog();
 
@@ -0,0 +1,221 @@
+#include "esphome/core/log.h"
+#include "p1_mini_aggregator.h"
+
+#include <cmath>
+
+namespace esphome {
+    namespace p1_mini {
+
+        namespace {
+            constexpr static const char *TAG = "p1_mini.aggregates";
+
+            // Gaps longer than this between two power values are not integrated. The configuration
+            // validation keeps the (maximum) request period within it.
+            constexpr static uint32_t max_power_gap_ms{ 10000 };
+
+            // Difference between two counter values, exact as long as they have the same number of decimals
+            float Difference(P1MiniValue from, P1MiniValue to)
+            {
+                if (from.decimals != to.decimals) return to.ToFloat() - from.ToFloat();
+                P1MiniValue difference;
+                difference.mantissa = to.mantissa - from.mantissa;
+                difference.decimals = to.decimals;
+                return difference.ToFloat();
+            }
+
+            void Publish(sensor::Sensor *sensor, float value)
+            {
+                if (sensor != nullptr && !std::isnan(value)) sensor->publish_state(value);
+            }
+        }
+
+        P1MiniAggregator::P1MiniAggregator(uint32_t power_obis, uint32_t import_obis, uint32_t export_obis, int num_peaks)
+            : m_power_obis{ power_obis }
+            , m_import_obis{ import_obis }
+            , m_export_obis{ export_obis }
+            , m_num_peaks{ num_peaks < 1 ? 1 : num_peaks > max_peaks ? max_peaks : num_peaks }
+        {
+            for (float &average : m_minute_averages) average = NAN;
+        }
+
+        P1MiniAggregator::Minute P1MiniAggregator::CurrentMinute() const
+        {
+#ifdef USE_TIME
+            if (m_time != nullptr) {
+                ESPTime const now{ m_time->now() };
+                if (now.is_valid()) {
+                    return Minute{ static_cast<int32_t>(now.timestamp / 60), now.minute, now.day_of_year };
+                }
+            }
+#endif
+            int32_t const number{ static_cast<int32_t>(millis() / 60000) };
+            return Minute{ number, number % 60, number / (24 * 60) };
+        }
+
+        void P1MiniAggregator::AddValue(uint32_t obis, P1MiniValue value)
+        {
+            Minute const minute{ CurrentMinute() };
+            if (!m_started) {
+                m_minute = minute;
+                m_started = true;
+            }
+            else if (minute.number != m_minute.number) EndMinute(minute);
+
+            if (obis == m_power_obis) AddPower(value.ToFloat());
+            else if (obis == m_import_obis) m_import = Counter{ value, true };
+            else if (obis == m_export_obis) m_export = Counter{ value, true };
+        }
+
+        void P1MiniAggregator::AddPower(float power)
+        {
+            uint32_t const now{ millis() };
+            if (m_has_power) {
+                uint32_t const duration{ now - m_last_power_time };
+                if (duration <= max_power_gap_ms) {
+                    m_minute_energy += m_last_power * duration;
+                    m_minute_duration += duration;
+                }
+            }
+            m_last_power = power;
+            m_last_power_time = now;
+            m_has_power = true;
+        }
+
+        void P1MiniAggregator::EndMinute(Minute const &next)
+        {
+            int32_t gap{ next.number - m_minute.number };
+            bool const continuous{ gap == 1 };
+            if (gap < 1 || gap > num_minutes) gap = num_minutes;
+
+            float average{ m_minute_duration > 0 ? m_minute_energy / m_minute_duration : NAN };
+            m_minute_energy = 0.0f;
+            m_minute_duration = 0;
+
+            // Minutes without any values are stored as NAN
+            for (int32_t i{ 0 }; i < gap; ++i) {
+                m_minute_index = (m_minute_index + 1) % num_minutes;
+                float const leaving_hour{ m_minute_averages[m_minute_index] };
+                float const leaving_15min{ m_minute_averages[(m_minute_index + num_minutes - 15) % num_minutes] };
+                if (!std::isnan(leaving_hour)) {
+                    m_sum_hour -= leaving_hour;
+                    --m_count_hour;
+                }
+                if (!std::isnan(leaving_15min)) {
+                    m_sum_15min -= leaving_15min;
+                    --m_count_15min;
+                }
+                if (!std::isnan(average)) {
+                    m_sum_hour += average;
+                    ++m_count_hour;
+                    m_sum_15min += average;
+                    ++m_count_15min;
+                }
+                m_minute_averages[m_minute_index] = average;
+                average = NAN;
+            }
+
+            // Recalculate the sums once in a while so rounding errors do not build up
+            if (m_minute_index == 0) {
+                m_sum_hour = m_sum_15min = 0.0f;
+                m_count_hour = m_count_15min = 0;
+                for (int i{ 0 }; i < num_minutes; ++i) {
+                    float const value{ m_minute_averages[i] };
+                    if (std::isnan(value)) continue;
+                    m_sum_hour += value;
+                    ++m_count_hour;
+                    if (i > num_minutes - 15) {
+                        m_sum_15min += value;
+                        ++m_count_15min;
+                    }
+                }
+                if (!std::isnan(m_minute_averages[0])) {
+                    m_sum_15min += m_minute_averages[0];
+                    ++m_count_15min;
+                }
+            }
+
+            if (m_count_15min > 0) Publish(m_average_power_15min_sensor, m_sum_15min / m_count_15min);
+            if (m_count_hour > 0) Publish(m_average_power_hour_sensor, m_sum_hour / m_count_hour);
+
+            bool const new_quarter{ gap >= 15 || next.minute_of_hour / 15 != m_minute.minute_of_hour / 15 };
+            bool const new_hour{ gap >= num_minutes || next.minute_of_hour < m_minute.minute_of_hour };
+            bool const new_day{ next.day != m_minute.day };
+            m_minute = next;
+
+            if (new_quarter) EndQuarter(continuous);
+            if (new_hour) EndHour(continuous);
+            if (new_day) m_num_stored_peaks = 0;
+        }
+
+        void P1MiniAggregator::EndQuarter(bool continuous)
+        {
+            // After a gap the counters at the end of the quarter are not known, and neither are
+            // they at the start of the next one, so both are not reported
+            if (!continuous) {
+                m_import_15min = m_export_15min = Counter{};
+                return;
+            }
+            if (m_import.valid && m_import_15min.valid) {
+                float const energy{ Difference(m_import_15min.value, m_import.value) };
+                if (energy >= 0.0f) Publish(m_import_energy_15min_sensor, energy);
+            }
+            if (m_export.valid && m_export_15min.valid) {
+                float const energy{ Difference(m_export_15min.value, m_export.value) };
+                if (energy >= 0.0f) Publish(m_export_energy_15min_sensor, energy);
+            }
+            m_import_15min = m_import;
+            m_export_15min = m_export;
+        }
+
+        void P1MiniAggregator::EndHour(bool continuous)
+        {
+            if (!continuous) {
+                m_import_hour = m_export_hour = Counter{};
+                return;
+            }
+            if (m_import.valid && m_import_hour.valid) {
+                float const energy{ Difference(m_import_hour.value, m_import.value) };
+                if (energy >= 0.0f) Publish(m_import_energy_hour_sensor, energy);
+            }
+            if (m_export.valid && m_export_hour.valid) {
+                float const energy{ Difference(m_export_hour.value, m_export.value) };
+                if (energy >= 0.0f) Publish(m_export_energy_hour_sensor, energy);
+            }
+            m_import_hour = m_import;
+            m_export_hour = m_export;
+
+            // Only hours with values for every minute count as peaks
+            if (m_count_hour != num_minutes) return;
+
+            float const average{ m_sum_hour / m_count_hour };
+            int position{ -1 };
+            if (m_num_stored_peaks < m_num_peaks) position = m_num_stored_peaks++;
+            else if (m_peaks[m_num_peaks - 1] < average) position = m_num_peaks - 1;
+            if (position >= 0) {
+                while (position > 0 && m_peaks[position - 1] < average) {
+                    m_peaks[position] = m_peaks[position - 1];
+                    --position;
+                }
+                m_peaks[position] = average;
+            }
+
+            float sum{ 0.0f };
+            for (int i{ 0 }; i < m_num_stored_peaks; ++i) sum += m_peaks[i];
+            Publish(m_hourly_peak_sensor, m_peaks[0]);
+            Publish(m_hourly_peaks_average_sensor, sum / m_num_stored_peaks);
+        }
+
+        void P1MiniAggregator::dump_config()
+        {
+            ESP_LOGCONFIG(TAG, "  Aggregates:");
+            ESP_LOGCONFIG(TAG, "    Power OBIS code: %d.%d.%d", m_power_obis >> 16, (m_power_obis >> 8) & 0xff, m_power_obis & 0xff);
+            ESP_LOGCONFIG(TAG, "    Import OBIS code: %d.%d.%d", m_import_obis >> 16, (m_import_obis >> 8) & 0xff, m_import_obis & 0xff);
+            ESP_LOGCONFIG(TAG, "    Export OBIS code: %d.%d.%d", m_export_obis >> 16, (m_export_obis >> 8) & 0xff, m_export_obis & 0xff);
+            ESP_LOGCONFIG(TAG, "    Peaks: %d", m_num_peaks);
+#ifdef USE_TIME
+            ESP_LOGCONFIG(TAG, "    Clock: %s", m_time != nullptr ? "yes" : "no (uptime)");
+#endif
+        }
+
+    } // namespace p1_mini
+} // namespace esphome
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/components/sensor/sensor.h"
+#ifdef USE_TIME
+#include "esphome/components/time/real_time_clock.h"
+#endif
+
+#include "p1_mini.h"
+
+namespace esphome {
+    namespace p1_mini {
+
+        // Calculates average power, the peaks of the hourly averages during the day and the
+        // energy used during each quarter and hour from the values received from the meter.
+        // Every value is added in constant time, so nothing but the per minute averages of the
+        // last hour needs to be kept.
+        class P1MiniAggregator
+        {
+        public:
+            P1MiniAggregator(uint32_t power_obis, uint32_t import_obis, uint32_t export_obis, int num_peaks);
+
+            // Called for every value received from the meter
+            void AddValue(uint32_t obis, P1MiniValue value);
+
+#ifdef USE_TIME
+            void set_time(time::RealTimeClock *time) { m_time = time; }
+#endif
+            void set_average_power_15min_sensor(sensor::Sensor *sensor) { m_average_power_15min_sensor = sensor; }
+            void set_average_power_hour_sensor(sensor::Sensor *sensor) { m_average_power_hour_sensor = sensor; }
+            void set_hourly_peak_sensor(sensor::Sensor *sensor) { m_hourly_peak_sensor = sensor; }
+            void set_hourly_peaks_average_sensor(sensor::Sensor *sensor) { m_hourly_peaks_average_sensor = sensor; }
+            void set_import_energy_15min_sensor(sensor::Sensor *sensor) { m_import_energy_15min_sensor = sensor; }
+            void set_import_energy_hour_sensor(sensor::Sensor *sensor) { m_import_energy_hour_sensor = sensor; }
+            void set_export_energy_15min_sensor(sensor::Sensor *sensor) { m_export_energy_15min_sensor = sensor; }
+            void set_export_energy_hour_sensor(sensor::Sensor *sensor) { m_export_energy_hour_sensor = sensor; }
+
+            void dump_config();
+
+        private:
+            uint32_t const m_power_obis;
+            uint32_t const m_import_obis;
+            uint32_t const m_export_obis;
+            int const m_num_peaks;
+
+#ifdef USE_TIME
+            time::RealTimeClock *m_time{ nullptr };
+#endif
+
+            // Minutes are counted from the clock when it is available, otherwise from uptime
+            struct Minute {
+                int32_t number; // Changes every minute
+                int minute_of_hour;
+                int day;
+            };
+            Minute CurrentMinute() const;
+            bool m_started{ false };
+            Minute m_minute{};
+
+            // Power integrated over the current minute
+            float m_last_power{ 0.0f };
+            uint32_t m_last_power_time{ 0 };
+            bool m_has_power{ false };
+            float m_minute_energy{ 0.0f }; // kW * ms
+            uint32_t m_minute_duration{ 0 }; // ms
+
+            // Average power of each of the last 60 minutes, NAN for minutes without values
+            constexpr static int num_minutes{ 60 };
+            float m_minute_averages[num_minutes];
+            int m_minute_index{ 0 };
+            float m_sum_15min{ 0.0f };
+            int m_count_15min{ 0 };
+            float m_sum_hour{ 0.0f };
+            int m_count_hour{ 0 };
+
+            // The highest hourly averages of the day, highest first
+            constexpr static int max_peaks{ 5 };
+            float m_peaks[max_peaks];
+            int m_num_stored_peaks{ 0 };
+
+            // Counter values at the start of the current quarter and hour
+            struct Counter {
+                P1MiniValue value;
+                bool valid{ false };
+            };
+            Counter m_import, m_import_15min, m_import_hour;
+            Counter m_export, m_export_15min, m_export_hour;
+
+            void AddPower(float power);
+            void EndMinute(Minute const &next);
+            void EndQuarter(bool continuous);
+            void EndHour(bool continuous);
+
+            sensor::Sensor *m_average_power_15min_sensor{ nullptr };
+            sensor::Sensor *m_average_power_hour_sensor{ nullptr };
+            sensor::Sensor *m_hourly_peak_sensor{ nullptr };
+            sensor::Sensor *m_hourly_peaks_average_sensor{ nullptr };
+            sensor::Sensor *m_import_energy_15min_sensor{ nullptr };
+            sensor::Sensor *m_import_energy_hour_sensor{ nullptr };
+            sensor::Sensor *m_export_energy_15min_sensor{ nullptr };
+            sensor::Sensor *m_export_energy_hour_sensor{ nullptr };
+        };
+
+    } // namespace p1_mini
+} // namespace esphome
@@ -0,0 +1,313 @@
+#include "p1_mini_history.h"
+#ifdef USE_P1_MINI_HISTORY
+
+#include "esphome/components/network/util.h"
+#include "esphome/core/log.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace esphome {
+    namespace p1_mini {
+
+        namespace {
+            constexpr static const char *TAG = "p1_mini.history";
+
+            // Small changes in either direction become small numbers
+            inline uint32_t ZigZag(int32_t value)
+            {
+                return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+            }
+
+            inline int32_t UnZigZag(uint32_t value)
+            {
+                return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+            }
+
+            // Seven bits per byte, with the high bit set on all but the last byte
+            inline bool WriteVarint(uint8_t *&position, uint8_t const *end, uint32_t value)
+            {
+                do {
+                    if (position == end) return false;
+                    uint8_t const byte{ static_cast<uint8_t>(value & 0x7f) };
+                    value >>= 7;
+                    *position++ = value != 0 ? byte | 0x80 : byte;
+                } while (value != 0);
+                return true;
+            }
+
+            // False if the value runs past the end, which only happens if the block is corrupt
+            inline bool ReadVarint(uint8_t const *&position, uint8_t const *end, uint32_t &value)
+            {
+                value = 0;
+                for (int shift{ 0 }; shift < 35; shift += 7) {
+                    if (position == end) return false;
+                    uint8_t const byte{ *position++ };
+                    value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+                    if ((byte & 0x80) == 0) return true;
+                }
+                return true;
+            }
+
+            // The steps the mantissa of a value is stored in: 1 to keep it exactly, or its
+            // resolution in units of the last decimal
+            inline int32_t Quantum(bool counter, float resolution, int decimals)
+            {
+                constexpr static float scales[P1MiniValue::max_decimals + 1]{ 1.0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f };
+                if (counter || resolution <= 0.0f) return 1;
+                float const quantum{ resolution * scales[std::min(decimals, static_cast<int>(P1MiniValue::max_decimals))] };
+                return quantum < 1.5f ? 1 : quantum < 1e9f ? static_cast<int32_t>(std::lround(quantum)) : 1000000000;
+            }
+
+            // To the nearest multiple of the quantum that fits
+            inline int32_t Round(int32_t mantissa, int32_t quantum)
+            {
+                int64_t const half{ quantum / 2 };
+                int64_t rounded{ (mantissa < 0 ? -((-int64_t{ mantissa } + half) / quantum) : (mantissa + half) / quantum) * quantum };
+                if (rounded > INT32_MAX) rounded -= quantum;
+                if (rounded < INT32_MIN) rounded += quantum;
+                return static_cast<int32_t>(rounded);
+            }
+
+            int Parameter(AsyncWebServerRequest *request, char const *name, int default_value)
+            {
+                if (!request->hasParam(name)) return default_value;
+                return atoi(request->getParam(name)->value().c_str());
+            }
+        }
+
+        P1MiniHistory::P1MiniHistory(web_server_base::WebServerBase *base, std::string path, int size)
+            : m_base{ base }
+            , m_path{ std::move(path) }
+        {
+            int const num_blocks{ size / block_size };
+            m_storage.reset(new uint8_t[num_blocks * block_size]);
+            if (!m_storage) {
+                ESP_LOGE(TAG, "Failed to allocate %d bytes for history.", num_blocks * block_size);
+                return;
+            }
+            m_blocks.resize(num_blocks);
+        }
+
+        void P1MiniHistory::Setup()
+        {
+            m_sample.resize(m_columns.size());
+            m_state.values.resize(m_columns.size());
+            m_state.deltas.resize(m_columns.size());
+        }
+
+        void P1MiniHistory::Loop()
+        {
+            // The web server can not be started before the network, which comes up after the
+            // component is set up. Samples are kept in the meantime.
+            if (m_serving || !network::is_connected()) return;
+            m_base->init();
+            m_base->add_handler(this);
+            m_serving = true;
+        }
+
+        void P1MiniHistory::AddSample(P1Mini const &p1_mini)
+        {
+            if (m_blocks.empty()) return;
+            // Only messages with all the values are kept
+            for (size_t i{ 0 }; i < m_columns.size(); ++i) {
+                if (!p1_mini.get_snapshot_value(m_columns[i].obis, m_sample[i])) return;
+                m_sample[i].mantissa = Round(m_sample[i].mantissa, Quantum(m_columns[i].counter, m_columns[i].resolution, m_sample[i].decimals));
+            }
+            uint32_t const now{ millis() };
+            LockGuard lock{ m_mutex };
+            if (m_num_blocks == 0 || !AppendSample(now)) StartBlock(now);
+        }
+
+        void P1MiniHistory::StartBlock(uint32_t now)
+        {
+            int const num_blocks{ static_cast<int>(m_blocks.size()) };
+            if (m_num_blocks == num_blocks) {
+                // Drop the oldest block
+                m_first_block = (m_first_block + 1) % num_blocks;
+                --m_num_blocks;
+            }
+            int const index{ (m_first_block + m_num_blocks++) % num_blocks };
+            uint8_t *const start{ m_storage.get() + index * block_size };
+            uint8_t *position{ start };
+            uint8_t const *const end{ start + block_size };
+
+            // The complete values, in steps of their resolution, which always fit in an empty block
+            for (int shift{ 0 }; shift < 32; shift += 8) *position++ = static_cast<uint8_t>(now >> shift);
+            for (size_t i{ 0 }; i < m_sample.size(); ++i) {
+                P1MiniValue const &value{ m_sample[i] };
+                *position++ = value.decimals;
+                WriteVarint(position, end, ZigZag(value.mantissa / Quantum(m_columns[i].counter, m_columns[i].resolution, value.decimals)));
+            }
+            m_blocks[index] = { static_cast<uint16_t>(position - start), 1 };
+
+            m_state.time = now;
+            m_state.time_delta = 0;
+            for (size_t i{ 0 }; i < m_sample.size(); ++i) {
+                m_state.values[i] = m_sample[i];
+                m_state.deltas[i] = 0;
+            }
+        }
+
+        bool P1MiniHistory::AppendSample(uint32_t now)
+        {
+            constexpr size_t max_columns{ 8 };
+            uint8_t encoded[5 * (1 + max_columns)];
+            uint8_t *position{ encoded };
+            uint8_t const *const end{ encoded + sizeof(encoded) };
+            if (m_columns.size() > max_columns) return false;
+
+            int32_t const time_delta{ static_cast<int32_t>(now - m_state.time) };
+            WriteVarint(position, end, ZigZag(time_delta - m_state.time_delta));
+            int32_t deltas[max_columns];
+            for (size_t i{ 0 }; i < m_columns.size(); ++i) {
+                // A change of the number of decimals, or a change too large to encode, starts a new block
+                if (m_sample[i].decimals != m_state.values[i].decimals) return false;
+                int64_t const delta{ static_cast<int64_t>(m_sample[i].mantissa) - m_state.values[i].mantissa };
+                // Both values are multiples of the quantum, which is 1 for counters
+                int64_t const encoded_delta{ m_columns[i].counter ? delta - m_state.deltas[i] : delta / Quantum(false, m_columns[i].resolution, m_sample[i].decimals) };
+                if (encoded_delta < INT32_MIN || INT32_MAX < encoded_delta || delta < INT32_MIN || INT32_MAX < delta) return false;
+                deltas[i] = static_cast<int32_t>(delta);
+                WriteVarint(position, end, ZigZag(static_cast<int32_t>(encoded_delta)));
+            }
+
+            int const index{ (m_first_block + m_num_blocks - 1) % static_cast<int>(m_blocks.size()) };
+            Block &block{ m_blocks[index] };
+            size_t const length{ static_cast<size_t>(position - encoded) };
+            if (block_size < block.length + length) return false;
+            std::memcpy(m_storage.get() + index * block_size + block.length, encoded, length);
+            block.length += length;
+            ++block.num_samples;
+
+            m_state.time = now;
+            m_state.time_delta = time_delta;
+            for (size_t i{ 0 }; i < m_columns.size(); ++i) {
+                m_state.values[i] = m_sample[i];
+                m_state.deltas[i] = deltas[i];
+            }
+            return true;
+        }
+
+        int P1MiniHistory::SampleCount() const
+        {
+            int count{ 0 };
+            for (int i{ 0 }; i < m_num_blocks; ++i) count += m_blocks[(m_first_block + i) % m_blocks.size()].num_samples;
+            return count;
+        }
+
+        bool P1MiniHistory::canHandle(AsyncWebServerRequest *request)
+        {
+            return request->method() == HTTP_GET && request->url() == m_path.c_str();
+        }
+
+        void P1MiniHistory::handleRequest(AsyncWebServerRequest *request)
+        {
+            // The response is built in memory, so it is returned a limited number of rows at a time
+#ifdef USE_ESP8266
+            constexpr int max_rows{ 100 };
+#else
+            constexpr int max_rows{ 500 };
+#endif
+            bool const json{ request->hasParam("format") && request->getParam("format")->value() == "json" };
+            int const first_row{ std::max(Parameter(request, "start", 0), 0) };
+            int const num_rows{ std::min(std::max(Parameter(request, "count", max_rows), 0), max_rows) };
+
+            uint32_t const now{ millis() };
+            bool has_clock{ false };
+            time_t epoch{ 0 };
+#ifdef USE_TIME
+            if (m_time != nullptr) {
+                ESPTime const clock{ m_time->now() };
+                has_clock = clock.is_valid();
+                epoch = clock.timestamp;
+            }
+#endif
+
+            AsyncResponseStream *const stream{ request->beginResponseStream(json ? "application/json" : "text/csv") };
+            LockGuard lock{ m_mutex };
+            char text[24];
+            if (json) stream->printf("{\"total\":%d,\"columns\":[\"age_ms\"%s", SampleCount(), has_clock ? ",\"timestamp\"" : "");
+            else stream->printf("age_ms%s", has_clock ? ",timestamp" : "");
+            for (Column const &column : m_columns) {
+                stream->printf(json ? ",\"%u.%u.%u\"" : ",%u.%u.%u", column.obis >> 16, (column.obis >> 8) & 0xff, column.obis & 0xff);
+            }
+            stream->printf(json ? "],\"rows\":[" : "\r\n");
+
+            // Decode from the oldest block, skipping whole blocks before the first row
+            int row{ 0 };
+            std::vector<P1MiniValue> values(m_columns.size());
+            std::vector<int32_t> deltas(m_columns.size());
+            std::vector<int32_t> quanta(m_columns.size());
+            for (int i{ 0 }; i < m_num_blocks && row < first_row + num_rows; ++i) {
+                int const index{ (m_first_block + i) % static_cast<int>(m_blocks.size()) };
+                Block const &block{ m_blocks[index] };
+                if (row + block.num_samples <= first_row) {
+                    row += block.num_samples;
+                    continue;
+                }
+                // Nothing is read past the bytes used, so a corrupt block ends the response early
+                // instead of reading the next block or past the storage
+                uint8_t const *position{ m_storage.get() + index * block_size };
+                uint8_t const *const end{ position + block.length };
+                uint32_t encoded{ 0 };
+                bool valid{ 4 <= block.length };
+                uint32_t time{ 0 };
+                for (int shift{ 0 }; valid && shift < 32; shift += 8) time |= static_cast<uint32_t>(*position++) << shift;
+                int32_t time_delta{ 0 };
+                for (size_t column{ 0 }; valid && column < m_columns.size(); ++column) {
+                    valid = position != end;
+                    if (valid) values[column].decimals = *position++;
+                    valid = valid && ReadVarint(position, end, encoded);
+                    quanta[column] = Quantum(m_columns[column].counter, m_columns[column].resolution, values[column].decimals);
+                    values[column].mantissa = UnZigZag(encoded) * quanta[column];
+                    deltas[column] = 0;
+                }
+                for (int sample{ 0 }; valid && sample < block.num_samples && row < first_row + num_rows; ++sample, ++row) {
+                    if (sample != 0) {
+                        valid = ReadVarint(position, end, encoded);
+                        time_delta += UnZigZag(encoded);
+                        time += time_delta;
+                        for (size_t column{ 0 }; valid && column < m_columns.size(); ++column) {
+                            valid = ReadVarint(position, end, encoded);
+                            deltas[column] = m_columns[column].counter ? deltas[column] + UnZigZag(encoded) : UnZigZag(encoded) * quanta[column];
+                            values[column].mantissa += deltas[column];
+                        }
+                        if (!valid) break;
+                    }
+                    if (row < first_row) continue;
+                    uint32_t const age{ now - time };
+                    if (json) stream->printf(row == first_row ? "[%u" : ",[%u", age);
+                    else stream->printf("%u", age);
+                    if (has_clock) stream->printf(",%u", static_cast<uint32_t>(epoch - age / 1000));
+                    for (P1MiniValue const &value : values) {
+                        value.Format(text, sizeof(text));
+                        stream->printf(",%s", text);
+                    }
+                    stream->printf(json ? "]" : "\r\n");
+                }
+                if (!valid) {
+                    ESP_LOGW(TAG, "History block %d is corrupt", index);
+                    break;
+                }
+            }
+            if (json) stream->printf("]}");
+            request->send(stream);
+        }
+
+        void P1MiniHistory::dump_config()
+        {
+            ESP_LOGCONFIG(TAG, "  History:");
+            ESP_LOGCONFIG(TAG, "    Path: %s", m_path.c_str());
+            ESP_LOGCONFIG(TAG, "    Size: %d bytes", static_cast<int>(m_blocks.size()) * block_size);
+            for (Column const &column : m_columns) {
+                if (column.resolution > 0.0f) ESP_LOGCONFIG(TAG, "    OBIS code: %d.%d.%d (resolution %g)", column.obis >> 16, (column.obis >> 8) & 0xff, column.obis & 0xff, column.resolution);
+                else ESP_LOGCONFIG(TAG, "    OBIS code: %d.%d.%d%s", column.obis >> 16, (column.obis >> 8) & 0xff, column.obis & 0xff, column.counter ? " (counter)" : "");
+            }
+        }
+
+    } // namespace p1_mini
+} // namespace esphome
+
+#endif // USE_P1_MINI_HISTORY
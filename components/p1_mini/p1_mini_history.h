@@ -0,0 +1,94 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#ifdef USE_P1_MINI_HISTORY
+
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "esphome/core/helpers.h"
+#ifdef USE_TIME
+#include "esphome/components/time/real_time_clock.h"
+#endif
+
+#include "p1_mini.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace esphome {
+    namespace p1_mini {
+
+        // Keeps the values of a few sensors from every message in a ring of small blocks and
+        // serves them as CSV or JSON through the web server, so gaps can be filled in afterwards.
+        // Each block starts with the complete values, followed by only the changes: the change
+        // of the change for counters and time, which grow steadily, and the change for other
+        // values. Most samples then need one or two bytes per value. Other values can be
+        // rounded to a resolution, so small fluctuations of power take less.
+        class P1MiniHistory : public AsyncWebHandler
+        {
+        public:
+            P1MiniHistory(web_server_base::WebServerBase *base, std::string path, int size);
+
+#ifdef USE_TIME
+            void set_time(time::RealTimeClock *time) { m_time = time; }
+#endif
+            // A resolution of 0 keeps the values exactly. Counters are always kept exactly.
+            void add_obis_code(uint32_t obis, float resolution = 0.0f) { m_columns.push_back({ obis, ((obis >> 8) & 0xff) == 8, resolution }); }
+
+            void Setup();
+            // Adds the handler to the web server once the network is up
+            void Loop();
+            void AddSample(P1Mini const &p1_mini);
+            void dump_config();
+
+            bool canHandle(AsyncWebServerRequest *request) override;
+            void handleRequest(AsyncWebServerRequest *request) override;
+
+        private:
+            web_server_base::WebServerBase *const m_base;
+            std::string const m_path;
+            bool m_serving{ false };
+#ifdef USE_TIME
+            time::RealTimeClock *m_time{ nullptr };
+#endif
+
+            struct Column {
+                uint32_t obis;
+                bool counter; // Cumulative values, such as x.8.y
+                float resolution; // Other values are rounded to this, 0 to keep them exactly
+            };
+            std::vector<Column> m_columns;
+
+            constexpr static int block_size{ 128 };
+            struct Block {
+                uint16_t length; // Bytes used
+                uint16_t num_samples;
+            };
+            std::unique_ptr<uint8_t[]> m_storage;
+            std::vector<Block> m_blocks;
+            int m_first_block{ 0 }; // Oldest block
+            int m_num_blocks{ 0 }; // Blocks in use, the last one is being written
+
+            // The last sample written, to calculate the changes from
+            struct State {
+                uint32_t time;
+                int32_t time_delta;
+                std::vector<P1MiniValue> values;
+                std::vector<int32_t> deltas;
+            };
+            State m_state;
+            std::vector<P1MiniValue> m_sample; // Reused for every sample
+
+            // The web server handles requests in a task of its own on the ESP32, while the
+            // samples are added from loop()
+            Mutex m_mutex;
+
+            void StartBlock(uint32_t now);
+            bool AppendSample(uint32_t now);
+            int SampleCount() const;
+        };
+
+    } // namespace p1_mini
+} // namespace esphome
+
+#endif // USE_P1_MINI_HISTORY
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace esphome {
+    namespace p1_mini {
+
+        // Lock-free ring buffer for bytes, for exactly one thread writing and one thread
+        // reading. Only depends on std::atomic, so it works the same on the ESP32 and on a PC.
+        class P1MiniRing
+        {
+        public:
+            explicit P1MiniRing(size_t capacity)
+                : m_buffer{ new uint8_t[capacity + 1] }
+                , m_size{ capacity + 1 } // One position is always left empty to tell full from empty
+            { }
+
+            // Writer side. Returns the number of bytes written, which is less than length if
+            // the ring is full.
+            size_t Write(uint8_t const *data, size_t length)
+            {
+                size_t const head{ m_head.load(std::memory_order_relaxed) };
+                size_t const tail{ m_tail.load(std::memory_order_acquire) };
+                size_t const free{ (tail + m_size - head - 1) % m_size };
+                if (length > free) length = free;
+                size_t const first{ length < m_size - head ? length : m_size - head };
+                std::memcpy(m_buffer.get() + head, data, first);
+                std::memcpy(m_buffer.get(), data + first, length - first);
+                m_head.store((head + length) % m_size, std::memory_order_release);
+                return length;
+            }
+
+            size_t Free() const
+            {
+                return m_size - 1 - Available();
+            }
+
+            // Reader side. Returns the number of bytes read.
+            size_t Read(uint8_t *data, size_t length)
+            {
+                size_t const tail{ m_tail.load(std::memory_order_relaxed) };
+                size_t const head{ m_head.load(std::memory_order_acquire) };
+                size_t const available{ (head + m_size - tail) % m_size };
+                if (length > available) length = available;
+                size_t const first{ length < m_size - tail ? length : m_size - tail };
+                std::memcpy(data, m_buffer.get() + tail, first);
+                std::memcpy(data + first, m_buffer.get(), length - first);
+                m_tail.store((tail + length) % m_size, std::memory_order_release);
+                return length;
+            }
+
+            size_t Available() const
+            {
+                size_t const head{ m_head.load(std::memory_order_acquire) };
+                size_t const tail{ m_tail.load(std::memory_order_acquire) };
+                return (head + m_size - tail) % m_size;
+            }
+
+        private:
+            std::unique_ptr<uint8_t[]> const m_buffer;
+            size_t const m_size;
+            std::atomic<size_t> m_head{ 0 }; // Only changed by the writer
+            std::atomic<size_t> m_tail{ 0 }; // Only changed by the reader
+        };
+
+    } // namespace p1_mini
+} // namespace esphome
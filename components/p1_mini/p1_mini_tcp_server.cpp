@@ -0,0 +1,154 @@
+#include "p1_mini_tcp_server.h"
+#ifdef USE_P1_MINI_TCP_SERVER
+
+#include "esphome/components/network/util.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cerrno>
+
+namespace esphome {
+    namespace p1_mini {
+
+        namespace {
+            constexpr static const char *TAG = "p1_mini.tcp_server";
+
+            bool WouldBlock()
+            {
+                return errno == EWOULDBLOCK || errno == EAGAIN;
+            }
+        }
+
+        P1MiniTcpServer::P1MiniTcpServer(uint16_t port, int max_clients)
+            : m_port{ port }
+            , m_max_clients{ static_cast<size_t>(max_clients) }
+        {
+            m_clients.reserve(m_max_clients);
+        }
+
+        void P1MiniTcpServer::Listen()
+        {
+            m_started = true;
+            m_socket = socket::socket_ip(SOCK_STREAM, 0);
+            if (!m_socket) {
+                ESP_LOGE(TAG, "Failed to create socket");
+                return;
+            }
+            int enable{ 1 };
+            m_socket->setsockopt(SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            m_socket->setblocking(false);
+
+            struct sockaddr_storage address;
+            socklen_t const length{ socket::set_sockaddr_any(reinterpret_cast<struct sockaddr *>(&address), sizeof(address), m_port) };
+            if (m_socket->bind(reinterpret_cast<struct sockaddr *>(&address), length) != 0 || m_socket->listen(static_cast<int>(m_max_clients)) != 0) {
+                ESP_LOGE(TAG, "Failed to listen on port %d", m_port);
+                m_socket.reset();
+            }
+        }
+
+        void P1MiniTcpServer::Loop()
+        {
+            if (!m_started && network::is_connected()) Listen();
+            if (!m_socket) return;
+            Accept();
+            for (Client &client : m_clients) {
+                if (!client.socket) continue;
+                // Nothing is expected from the clients, but reading tells if they have disconnected
+                uint8_t discarded[16];
+                ssize_t const received{ client.socket->read(discarded, sizeof(discarded)) };
+                if (received == 0) Disconnect(client, "closed by client");
+                else if (received < 0 && !WouldBlock()) Disconnect(client, "read failed");
+                else if (client.pending) Send(client);
+            }
+            RemoveDisconnected();
+        }
+
+        void P1MiniTcpServer::RemoveDisconnected()
+        {
+            m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(), [](Client const &client) { return !client.socket; }), m_clients.end());
+        }
+
+        void P1MiniTcpServer::Accept()
+        {
+            for (;;) {
+                struct sockaddr_storage address;
+                socklen_t length{ sizeof(address) };
+                std::unique_ptr<socket::Socket> socket{ m_socket->accept(reinterpret_cast<struct sockaddr *>(&address), &length) };
+                if (!socket) return;
+                if (m_clients.size() == m_max_clients) {
+                    ESP_LOGW(TAG, "Too many clients, connection refused");
+                    socket->close();
+                    continue;
+                }
+                socket->setblocking(false);
+                int enable{ 1 };
+                socket->setsockopt(IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                // Starts with the next message, so a client never gets the end of one
+                m_clients.push_back({ std::move(socket), 0, false });
+                ESP_LOGD(TAG, "Client connected (%u clients)", static_cast<unsigned>(m_clients.size()));
+            }
+        }
+
+        void P1MiniTcpServer::SendMessage(char const *data, size_t length)
+        {
+            Release();
+            m_data = data;
+            m_length = length;
+            for (Client &client : m_clients) {
+                if (!client.socket) continue;
+                client.sent = 0;
+                client.pending = true;
+                Send(client);
+            }
+        }
+
+        void P1MiniTcpServer::Send(Client &client)
+        {
+            ssize_t const written{ client.socket->write(m_data + client.sent, m_length - client.sent) };
+            if (written < 0) {
+                if (!WouldBlock()) Disconnect(client, "write failed");
+                return;
+            }
+            client.sent += written;
+            if (client.sent == m_length) client.pending = false;
+        }
+
+        void P1MiniTcpServer::Release()
+        {
+            // The buffer is about to be reused. A client that has not received any of the
+            // message just misses it, but one that has received part of it is disconnected
+            // so it never gets an incomplete message.
+            for (Client &client : m_clients) {
+                if (!client.pending) continue;
+                client.pending = false;
+                if (client.sent == 0) {
+                    ++m_num_dropped;
+                    ESP_LOGD(TAG, "Client too slow, message dropped (%u dropped)", m_num_dropped);
+                }
+                else Disconnect(client, "too slow to receive a message");
+            }
+            RemoveDisconnected();
+            m_data = nullptr;
+            m_length = 0;
+        }
+
+        void P1MiniTcpServer::Disconnect(Client &client, char const *reason)
+        {
+            if (!client.socket) return;
+            ESP_LOGD(TAG, "Client disconnected: %s", reason);
+            client.socket->close();
+            client.socket.reset();
+            client.pending = false;
+        }
+
+        void P1MiniTcpServer::dump_config()
+        {
+            ESP_LOGCONFIG(TAG, "  TCP server:");
+            ESP_LOGCONFIG(TAG, "    Port: %d", m_port);
+            ESP_LOGCONFIG(TAG, "    Max clients: %u", static_cast<unsigned>(m_max_clients));
+        }
+
+    } // namespace p1_mini
+} // namespace esphome
+
+#endif // USE_P1_MINI_TCP_SERVER
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#ifdef USE_P1_MINI_TCP_SERVER
+
+#include "esphome/components/socket/socket.h"
+
+#include <memory>
+#include <vector>
+
+namespace esphome {
+    namespace p1_mini {
+
+        // Sends every verified message to the clients connected to a TCP port. The message is
+        // sent straight from the message buffer of the P1Mini component, so nothing is copied.
+        // A client that can not keep up misses messages instead of holding up the component.
+        // It starts listening once the network is up, as lwIP can not be used before that.
+        class P1MiniTcpServer
+        {
+        public:
+            P1MiniTcpServer(uint16_t port, int max_clients);
+
+            void Loop();
+
+            // The data must stay unchanged until Release() is called
+            void SendMessage(char const *data, size_t length);
+            void Release();
+
+            void dump_config();
+
+        private:
+            uint16_t const m_port;
+            size_t const m_max_clients;
+            std::unique_ptr<socket::Socket> m_socket;
+            bool m_started{ false }; // Listening, or failed to
+
+            struct Client {
+                std::unique_ptr<socket::Socket> socket;
+                size_t sent; // Bytes of the current message sent to this client
+                bool pending; // The current message is still to be sent
+            };
+            std::vector<Client> m_clients;
+
+            char const *m_data{ nullptr };
+            size_t m_length{ 0 };
+            uint32_t m_num_dropped{ 0 };
+
+            void Listen();
+            void Accept();
+            void Send(Client &client);
+            void Disconnect(Client &client, char const *reason);
+            void RemoveDisconnected();
+        };
+
+    } // namespace p1_mini
+} // namespace esphome
+
+#endif // USE_P1_MINI_TCP_SERVER
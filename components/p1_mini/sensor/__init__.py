@@ -3,27 +3,39 @@ import esphome.config_validation as cv
 from esphome.components import sensor
 from esphome.const import CONF_FORMAT, CONF_ID, CONF_TIMEOUT
 
-from .. import CONF_P1_MINI_ID, CONF_OBIS_CODE, P1Mini, obis_code, p1_mini_ns
+from .. import CONF_P1_MINI_ID, CONF_OBIS_CODE, P1Mini, obis_code, packed_obis_code, p1_mini_ns
 
 AUTO_LOAD = ["p1_mini"]
 
+CONF_PUBLISH_ON_CHANGE = "publish_on_change"
+CONF_DELTA = "delta"
+CONF_MAX_INTERVAL = "max_interval"
+
 P1MiniSensor = p1_mini_ns.class_(
-    "P1MiniSensor", sensor.Sensor, cg.Component)
+    "P1MiniSensor", sensor.Sensor)
 
 CONFIG_SCHEMA = sensor.sensor_schema(P1MiniSensor).extend(
     {
         cv.GenerateID(): cv.declare_id(P1MiniSensor),
         cv.GenerateID(CONF_P1_MINI_ID): cv.use_id(P1Mini),
-        cv.Required(CONF_OBIS_CODE): cv.string
+        cv.Required(CONF_OBIS_CODE): obis_code,
+        cv.Optional(CONF_PUBLISH_ON_CHANGE, default=False): cv.boolean,
+        cv.Optional(CONF_DELTA): cv.positive_float,
+        cv.Optional(CONF_MAX_INTERVAL): cv.positive_time_period_milliseconds,
     }
 )
 
 async def to_code(config):
     var = cg.new_Pvariable(
         config[CONF_ID],
-        config[CONF_OBIS_CODE],
+        packed_obis_code(config[CONF_OBIS_CODE]),
     )
-    await cg.register_component(var, config)
     await sensor.register_sensor(var, config)
     p1_mini = await cg.get_variable(config[CONF_P1_MINI_ID])
     cg.add(p1_mini.register_sensor(var))
+
+    cg.add(var.set_publish_on_change(config[CONF_PUBLISH_ON_CHANGE]))
+    if CONF_DELTA in config:
+        cg.add(var.set_delta(config[CONF_DELTA]))
+    if CONF_MAX_INTERVAL in config:
+        cg.add(var.set_max_interval(config[CONF_MAX_INTERVAL].total_milliseconds))
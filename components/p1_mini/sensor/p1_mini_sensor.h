@@ -10,14 +10,14 @@ namespace esphome
 {
     namespace p1_mini
     {
-        class P1MiniSensor : public P1MiniSensorBase, public sensor::Sensor, public Component
+        class P1MiniSensor : public P1MiniSensorBase, public sensor::Sensor
         {
         public:
-            P1MiniSensor(std::string obis_code)
+            P1MiniSensor(uint32_t obis_code)
                 : P1MiniSensorBase{ obis_code }
             {}
 
-            virtual void publish_val(double value) override { publish_state(value); }
+            virtual void publish_val(P1MiniValue value) override { publish_state(value.ToFloat()); }
 
         };
 
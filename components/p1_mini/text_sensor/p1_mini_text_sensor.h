@@ -2,7 +2,7 @@
 
 #include <string>
 
-#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/text_sensor/text_sensor.h"
 
 #include "../p1_mini.h"
 
@@ -10,14 +10,19 @@ namespace esphome
 {
     namespace p1_mini
     {
-        class P1MiniTextSensor : public P1MiniTextSensorBase, public text_sensor::TextSensor, public Component
+        class P1MiniTextSensor : public P1MiniTextSensorBase, public text_sensor::TextSensor
         {
         public:
             P1MiniTextSensor(std::string identifier)
                 : P1MiniTextSensorBase{ identifier }
             {}
 
-            virtual void publish_val(std::string value) override { publish_state(value); }
+            virtual bool publish_val(char const *value, size_t length) override
+            {
+                if (!UpdateLastValue(value, length)) return false;
+                publish_state(m_last_value);
+                return true;
+            }
 
         };
 
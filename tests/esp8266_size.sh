@@ -0,0 +1,38 @@
+#!/bin/sh
+# Builds p1mini.yaml for the ESP8266 with esphome compile at two revisions and shows the
+# RAM and flash use PlatformIO reports for each, to see what a change costs or saves.
+#   tests/esp8266_size.sh [before [after]]
+# The revisions default to the parent of the last commit and the last commit. Needs git and
+# esphome (pip install esphome); the first build downloads the ESP8266 toolchain.
+
+set -e
+command -v esphome > /dev/null || { echo "esphome not found, install it with pip install esphome"; exit 1; }
+
+before=${1:-HEAD^}
+after=${2:-HEAD}
+repo=$(git rev-parse --show-toplevel)
+work=$(mktemp -d)
+trap 'git -C "$repo" worktree remove --force "$work/before" 2>/dev/null; git -C "$repo" worktree remove --force "$work/after" 2>/dev/null; rm -rf "$work"' EXIT
+
+for name in before after; do
+    eval revision=\$$name
+    git -C "$repo" worktree add --detach --quiet "$work/$name" "$revision"
+    # The configuration only needs the secrets to exist, their values do not matter here
+    cat > "$work/$name/secrets.yaml" <<EOF
+p1mini_password: "password"
+p1mini_api_key: "MDEyMzQ1Njc4OTAxMjM0NTY3ODkwMTIzNDU2Nzg5MDE="
+wifi_ssid: "ssid"
+wifi_password: "password"
+EOF
+    echo "Building $name ($revision)"
+    (cd "$work/$name" && esphome compile p1mini.yaml) > "$work/$name.log" 2>&1 || {
+        tail -n 30 "$work/$name.log"
+        exit 1
+    }
+done
+
+for name in before after; do
+    eval revision=\$$name
+    echo "$name ($(git -C "$repo" rev-parse --short "$revision")):"
+    grep -E '^(RAM|Flash):' "$work/$name.log"
+done
@@ -0,0 +1,186 @@
+#include "host.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+
+namespace esphome {
+    namespace host {
+
+        namespace {
+            char const *const obis_codes[]{
+                "1.8.0", "2.8.0", "3.8.0", "4.8.0", "1.7.0", "2.7.0", "3.7.0", "4.7.0",
+                "21.7.0", "41.7.0", "61.7.0", "22.7.0", "42.7.0", "62.7.0",
+                "23.7.0", "43.7.0", "63.7.0", "24.7.0", "44.7.0", "64.7.0",
+                "32.7.0", "52.7.0", "72.7.0", "31.7.0", "51.7.0", "71.7.0",
+            };
+        }
+
+        std::string ReadTelegram(char const *name)
+        {
+            std::ifstream file{ std::string{ P1_MINI_TELEGRAMS_DIR "/" } + name, std::ios::binary };
+            HOST_CHECK(file.good());
+            std::stringstream data;
+            data << file.rdbuf();
+            return data.str();
+        }
+
+        std::vector<std::string> TelegramNames()
+        {
+            std::vector<std::string> names;
+            DIR *const dir{ opendir(P1_MINI_TELEGRAMS_DIR) };
+            HOST_CHECK(dir != nullptr);
+            while (dirent const *const entry = readdir(dir)) {
+                std::string const name{ entry->d_name };
+                size_t const extension{ name.rfind('.') };
+                if (extension != std::string::npos && (name.compare(extension, 4, ".txt") == 0 || name.compare(extension, 4, ".bin") == 0)) names.push_back(name);
+            }
+            closedir(dir);
+            std::sort(names.begin(), names.end());
+            return names;
+        }
+
+        uint16_t AsciiCrc(char const *data, size_t length)
+        {
+            uint16_t crc{ 0 };
+            for (size_t i{ 0 }; i < length; ++i) {
+                crc ^= static_cast<uint8_t>(data[i]);
+                for (int bit{ 0 }; bit < 8; ++bit) crc = crc & 1 ? (crc >> 1) ^ 0xa001 : crc >> 1;
+            }
+            return crc;
+        }
+
+        uint16_t BinaryCrc(uint8_t const *data, size_t length)
+        {
+            uint16_t crc{ 0xffff };
+            for (size_t i{ 0 }; i < length; ++i) {
+                crc ^= data[i];
+                for (int bit{ 0 }; bit < 8; ++bit) crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+            }
+            return crc ^ 0xffff;
+        }
+
+        std::string FinishAsciiTelegram(std::string message, bool bad_crc)
+        {
+            char crc[8];
+            std::snprintf(crc, sizeof(crc), "%04X\r\n", AsciiCrc(message.data(), message.size()) ^ (bad_crc ? 1 : 0));
+            return message + crc;
+        }
+
+        std::vector<uint8_t> FinishBinaryTelegram(std::vector<uint8_t> frame)
+        {
+            // The length is from the format byte through the CRC
+            size_t const length{ frame.size() - 1 + 2 };
+            frame[1] = 0xa0 | ((length >> 8) & 0x1f);
+            frame[2] = length & 0xff;
+            uint16_t const crc{ BinaryCrc(frame.data() + 1, frame.size() - 1) };
+            frame.push_back(crc & 0xff);
+            frame.push_back(crc >> 8);
+            frame.push_back(0x7e);
+            return frame;
+        }
+
+        std::string AsciiTelegram(int n, bool bad_crc)
+        {
+            char message[2048];
+            std::snprintf(message, sizeof(message),
+                "/ELL5\\253833635_A\r\n\r\n"
+                "0-0:1.0.0(2410%02d123456W)\r\n"
+                "1-0:1.8.0(%08d.%03d*kWh)\r\n1-0:2.8.0(00000000.000*kWh)\r\n1-0:3.8.0(00000021.434*kvarh)\r\n1-0:4.8.0(00001743.019*kvarh)\r\n"
+                "1-0:1.7.0(0000.%03d*kW)\r\n1-0:2.7.0(0000.000*kW)\r\n1-0:3.7.0(0000.000*kvar)\r\n1-0:4.7.0(0000.160*kvar)\r\n"
+                "1-0:21.7.0(0000.054*kW)\r\n1-0:41.7.0(0000.143*kW)\r\n1-0:61.7.0(0000.083*kW)\r\n"
+                "1-0:22.7.0(0000.000*kW)\r\n1-0:42.7.0(0000.000*kW)\r\n1-0:62.7.0(0000.000*kW)\r\n"
+                "1-0:23.7.0(0000.000*kvar)\r\n1-0:43.7.0(0000.000*kvar)\r\n1-0:63.7.0(0000.000*kvar)\r\n"
+                "1-0:24.7.0(0000.059*kvar)\r\n1-0:44.7.0(0000.059*kvar)\r\n1-0:64.7.0(0000.041*kvar)\r\n"
+                "1-0:32.7.0(230.%d*V)\r\n1-0:52.7.0(231.0*V)\r\n1-0:72.7.0(229.8*V)\r\n"
+                "1-0:31.7.0(000.5*A)\r\n1-0:51.7.0(000.8*A)\r\n1-0:71.7.0(000.6*A)\r\n!",
+                n % 60, 12345 + n / 1000, n % 1000, (280 + n) % 1000, n % 10);
+            return FinishAsciiTelegram(message, bad_crc);
+        }
+
+        std::string LargeAsciiTelegram(int n, size_t size)
+        {
+            std::string message{ AsciiTelegram(n) };
+            size_t const end_length{ 7 }; // "!", the CRC and "\r\n"
+            message.resize(message.size() - end_length);
+            for (int line{ 0 }; message.size() + end_length < size; ++line) {
+                char text[128];
+                int const prefix_length{ std::snprintf(text, sizeof(text), "0-0:96.13.%d(", line) };
+                size_t const used{ message.size() + prefix_length + 3 + end_length };
+                size_t const length{ used < size ? std::min<size_t>(1024, size - used) : 0 };
+                message += text;
+                for (size_t i{ 0 }; i < length; ++i) message += "0123456789ABCDEF"[(i + line) % 16];
+                message += ")\r\n";
+            }
+            return FinishAsciiTelegram(message + '!');
+        }
+
+        std::vector<uint8_t> BinaryTelegram(int n)
+        {
+            std::vector<uint8_t> frame{ 0x7e, 0xa0, 0x00, 0x41, 0x08, 0x83, 0x13, 0x00, 0x00, 0xe6, 0xe7, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x03 };
+            auto obis = [&frame](uint8_t major, uint8_t minor, uint8_t micro) {
+                frame.insert(frame.end(), { 0x02, 0x02, 0x09, 0x06, 0x01, 0x00, major, minor, micro, 0xff });
+                };
+            obis(1, 8, 0);
+            uint32_t const energy{ 12345678u + n };
+            frame.insert(frame.end(), { 0x06, uint8_t(energy >> 24), uint8_t(energy >> 16), uint8_t(energy >> 8), uint8_t(energy) });
+            obis(32, 7, 0);
+            frame.insert(frame.end(), { 0x12, 0x09, uint8_t(0x0c + n % 3) });
+            obis(0, 0, 1);
+            frame.insert(frame.end(), { 0x0a, 3, 'a', 'b', 'c' });
+            return FinishBinaryTelegram(frame);
+        }
+
+        std::map<uint32_t, float> AsciiValues(std::string const &telegram)
+        {
+            std::map<uint32_t, float> values;
+            std::istringstream lines{ telegram };
+            std::string line;
+            while (std::getline(lines, line)) {
+                unsigned major, minor, micro;
+                float value;
+                if (std::sscanf(line.c_str(), "1-0:%u.%u.%u(%f", &major, &minor, &micro, &value) == 4) {
+                    values[major << 16 | minor << 8 | micro] = value;
+                }
+            }
+            return values;
+        }
+
+        uint32_t Obis(char const *obis_code)
+        {
+            unsigned major, minor, micro;
+            HOST_CHECK(std::sscanf(obis_code, "%u.%u.%u", &major, &minor, &micro) == 3);
+            return major << 16 | minor << 8 | micro;
+        }
+
+        Rig::Rig(uint32_t min_period_ms, int buffer_size)
+            : p1{ min_period_ms, buffer_size }
+        {
+            p1.set_uart_parent(&uart);
+            for (char const *const obis_code : obis_codes) {
+                auto *const sensor{ new p1_mini::P1MiniSensor{ Obis(obis_code) } };
+                sensors[Obis(obis_code)] = sensor;
+                p1.register_sensor(sensor);
+            }
+            p1.register_text_sensor(&identification);
+            p1.register_text_sensor(&clock);
+        }
+
+        void Rig::Start()
+        {
+            p1.setup();
+            Run(600);
+        }
+
+        void Rig::Run(int ms)
+        {
+            for (int i{ 0 }; i < ms; ++i) {
+                p1.loop();
+                advance_clock(1);
+            }
+        }
+
+    } // namespace host
+} // namespace esphome
@@ -0,0 +1,77 @@
+#pragma once
+
+// Shared by the host tests, benchmarks and tools: builds messages and runs the component
+// against the stubbed UART and clock.
+
+#include "host_stubs.h"
+#include "p1_mini.h"
+#include "sensor/p1_mini_sensor.h"
+#include "text_sensor/p1_mini_text_sensor.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace esphome {
+    namespace host {
+
+        // Stops the test with the location of the first check that fails
+#define HOST_CHECK(condition)                                                            \
+    do {                                                                                 \
+        if (!(condition)) {                                                              \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);   \
+            std::exit(1);                                                                \
+        }                                                                                \
+    } while (0)
+
+        // Bytes of a file in the telegrams directory
+        std::string ReadTelegram(char const *name);
+        std::vector<std::string> TelegramNames();
+
+        // CRC16/ARC over the ASCII message, and CRC-16/X.25 over the HDLC frame
+        uint16_t AsciiCrc(char const *data, size_t length);
+        uint16_t BinaryCrc(uint8_t const *data, size_t length);
+
+        // Appends the CRC to an ASCII message that ends with '!'
+        std::string FinishAsciiTelegram(std::string message, bool bad_crc = false);
+        // Sets the length and the CRC of an HDLC frame, and adds the end flag
+        std::vector<uint8_t> FinishBinaryTelegram(std::vector<uint8_t> frame);
+
+        // A message like the ones from the Sagemcom T211, with values changing with n
+        std::string AsciiTelegram(int n, bool bad_crc = false);
+        // The same, padded to about the given size with text messages (0-0:96.13.0)
+        std::string LargeAsciiTelegram(int n, size_t size);
+        // An HDLC frame with 1.8.0, 32.7.0 and a string, with values changing with n
+        std::vector<uint8_t> BinaryTelegram(int n);
+
+        // The values of the 1-0 lines of an ASCII message, parsed without the component
+        std::map<uint32_t, float> AsciiValues(std::string const &telegram);
+
+        uint32_t Obis(char const *obis_code);
+
+        // A component with the UART, a sensor for each of the usual OBIS codes, and the
+        // identification and clock text sensors.
+        class Rig {
+        public:
+            Rig(uint32_t min_period_ms = 0, int buffer_size = 3072);
+
+            // Runs the component past the error recovery it starts in
+            void Start();
+            // One loop() per simulated millisecond
+            void Run(int ms);
+            void Send(std::string const &data) { uart.push(data); }
+            void Send(std::vector<uint8_t> const &data) { uart.push(data); }
+
+            p1_mini::P1MiniSensor &Sensor(char const *obis_code) { return *sensors.at(Obis(obis_code)); }
+
+            uart::UARTComponent uart;
+            p1_mini::P1Mini p1;
+            std::map<uint32_t, p1_mini::P1MiniSensor *> sensors;
+            p1_mini::P1MiniTextSensor identification{ "/" };
+            p1_mini::P1MiniTextSensor clock{ "0-0:1.0.0(" };
+        };
+
+    } // namespace host
+} // namespace esphome
@@ -0,0 +1,95 @@
+#include "meter_sim.h"
+
+#include <algorithm>
+
+namespace esphome {
+    namespace host {
+
+        SimulatedMeter::SimulatedMeter(uart::UARTComponent &uart, MeterOptions const &options)
+            : m_uart{ uart }
+            , m_options{ options }
+            , m_random{ options.seed }
+        { }
+
+        void SimulatedMeter::Connect(p1_mini::P1Mini &p1)
+        {
+            m_ready.callback = [this]() { m_rts_state = true; };
+            m_received.callback = [this]() { m_rts_state = false; };
+            m_error.callback = [this]() { m_rts_state = false; };
+            p1.register_ready_to_receive_trigger(&m_ready);
+            p1.register_update_received_trigger(&m_received);
+            p1.register_communication_error_trigger(&m_error);
+        }
+
+        void SimulatedMeter::Run(uint32_t now)
+        {
+            if (m_position == m_message.size()) {
+                if (static_cast<int32_t>(now - m_next_time) < 0 || (m_options.rts && !m_rts_state)) return;
+                StartMessage(now);
+            }
+
+            size_t length{ m_message.size() - m_position };
+            if (m_options.baud_rate != 0) {
+                m_byte_credit += m_options.baud_rate / 10000.0;
+                length = std::min(length, static_cast<size_t>(m_byte_credit));
+                m_byte_credit -= length;
+            }
+            Push(m_message.data() + m_position, length);
+            m_position += length;
+            if (m_position == m_message.size()) {
+                m_last_energy = m_energy;
+                m_last_intact = m_intact;
+                m_last_damaged = m_damaged;
+            }
+        }
+
+        void SimulatedMeter::StartMessage(uint32_t now)
+        {
+            int const n{ num_sent++ };
+            if (m_options.binary) {
+                std::vector<uint8_t> const frame{ BinaryTelegram(n) };
+                m_message.assign(frame.begin(), frame.end());
+                m_energy = 12345678 + n;
+            }
+            else {
+                m_message = m_options.size == 0 ? AsciiTelegram(n) : LargeAsciiTelegram(n, m_options.size);
+                m_energy = 12345000 + n;
+            }
+
+            // The distance to the next flipped bit follows from the error rate
+            size_t const crc_end{ m_options.binary ? m_message.size() - 1 : m_message.rfind('!') + 5 };
+            m_intact = true;
+            m_damaged = false;
+            if (m_options.bit_error_rate > 0) {
+                std::geometric_distribution<size_t> distance{ m_options.bit_error_rate };
+                for (size_t bit{ distance(m_random) }; bit < m_message.size() * 8; bit += 1 + distance(m_random)) {
+                    m_message[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+                    m_intact = m_intact && crc_end <= bit / 8;
+                    m_damaged = true;
+                }
+            }
+            if (m_damaged) ++num_corrupted;
+
+            m_position = 0;
+            m_byte_credit = 0;
+            uint32_t const jitter{ m_options.jitter_ms == 0 ? 0 : static_cast<uint32_t>(m_random() % (m_options.jitter_ms + 1)) };
+            m_next_time = now + m_options.period_ms + jitter;
+        }
+
+        void SimulatedMeter::Push(char const *data, size_t length)
+        {
+            if (m_options.uart_buffer_size != 0) {
+                size_t const used{ static_cast<size_t>(m_uart.available()) };
+                size_t const room{ used < m_options.uart_buffer_size ? m_options.uart_buffer_size - used : 0 };
+                if (room < length) {
+                    num_bytes_lost += length - room;
+                    length = room;
+                    m_intact = false;
+                    m_damaged = true;
+                }
+            }
+            m_uart.push(reinterpret_cast<uint8_t const *>(data), length);
+        }
+
+    } // namespace host
+} // namespace esphome
@@ -0,0 +1,72 @@
+#pragma once
+
+// A meter that sends messages to the stubbed UART at the pace of the serial line, with
+// jitter, bit errors and the RTS signal, for the load generator and the soak test.
+
+#include "host.h"
+
+#include <random>
+
+namespace esphome {
+    namespace host {
+
+        struct MeterOptions {
+            bool binary{ false }; // HDLC frames instead of ASCII messages
+            size_t size{ 0 }; // ASCII messages are padded to about this size, 0 for the usual size
+            uint32_t period_ms{ 1000 }; // From the start of one message to the next
+            uint32_t jitter_ms{ 0 }; // Up to this much is added to each period
+            uint32_t baud_rate{ 115200 }; // 8N1, so 10 bits per byte. 0 sends each message at once
+            double bit_error_rate{ 0 };
+            bool rts{ false }; // Only starts a message while the component asks for one
+            size_t uart_buffer_size{ 0 }; // Bytes that do not fit are lost, 0 for no limit
+            uint32_t seed{ 1 };
+        };
+
+        class SimulatedMeter {
+        public:
+            SimulatedMeter(uart::UARTComponent &uart, MeterOptions const &options);
+
+            // Follows the RTS signal the way the example configuration drives it: on when the
+            // component is ready to receive, off once a message is received or on an error
+            void Connect(p1_mini::P1Mini &p1);
+
+            // Sends what is due by now. Called every simulated millisecond.
+            void Run(uint32_t now);
+
+            // The value of 1.8.0 in the last message sent completely, which is different in
+            // each message. It is intact if nothing up to the end of the CRC was changed or
+            // lost, and damaged if anything was, including the line end or flag after the CRC.
+            int32_t LastEnergy() const { return m_last_energy; }
+            bool LastIntact() const { return m_last_intact; }
+            bool LastDamaged() const { return m_last_damaged; }
+
+            int num_sent{ 0 };
+            int num_corrupted{ 0 }; // Messages with at least one bit flipped
+            size_t num_bytes_lost{ 0 }; // Did not fit in the UART buffer
+
+        private:
+            uart::UARTComponent &m_uart;
+            MeterOptions const m_options;
+            std::minstd_rand m_random;
+            p1_mini::ReadyToReceiveTrigger m_ready;
+            p1_mini::UpdateReceivedTrigger m_received;
+            p1_mini::CommunicationErrorTrigger m_error;
+            bool m_rts_state{ false };
+
+            uint32_t m_next_time{ 0 };
+            std::string m_message;
+            size_t m_position{ 0 };
+            double m_byte_credit{ 0 };
+            int32_t m_energy{ 0 };
+            bool m_intact{ true };
+            bool m_damaged{ false };
+            int32_t m_last_energy{ -1 };
+            bool m_last_intact{ false };
+            bool m_last_damaged{ false };
+
+            void StartMessage(uint32_t now);
+            void Push(char const *data, size_t length);
+        };
+
+    } // namespace host
+} // namespace esphome
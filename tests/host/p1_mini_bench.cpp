@@ -0,0 +1,144 @@
+// Replays the messages in the telegrams directory through the component with the real clock,
+// and reports the throughput, the time spent reading and verifying versus processing and
+// publishing each message, and the number of values published. The whole message is in the
+// UART buffer when the cycle starts, so the times are those of the component alone. A 3 KB
+// message shows the time from its end to the first value published.
+//   p1_mini_bench [--quick] [number of messages]
+
+#include "host.h"
+
+#include <chrono>
+#include <cstring>
+
+using namespace esphome;
+using namespace esphome::host;
+using namespace esphome::p1_mini;
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    double Microseconds(Clock::duration duration) { return std::chrono::duration<double, std::micro>(duration).count(); }
+
+    struct Result {
+        double read_us{ 0 }; // Identifying, reading and verifying the CRC
+        double process_us{ 0 }; // Processing and publishing
+        int loops{ 0 };
+        int published{ 0 };
+        int messages{ 0 };
+    };
+
+    Result Replay(std::string const &telegram, int num_messages)
+    {
+        Rig &rig{ *new Rig{ 0, 4096 } };
+        UpdateReceivedTrigger received;
+        UpdateProcessedTrigger processed;
+        Clock::time_point received_time, processed_time;
+        received.callback = [&received_time]() { received_time = Clock::now(); };
+        processed.callback = [&processed_time]() { processed_time = Clock::now(); };
+        rig.p1.register_update_received_trigger(&received);
+        rig.p1.register_update_processed_trigger(&processed);
+        rig.Start();
+
+        use_real_clock(true);
+        Result result;
+        for (int n{ 0 }; n < num_messages; ++n) {
+            int const published{ num_published };
+            int const num_processed{ processed.count };
+            Clock::time_point const start_time{ Clock::now() };
+            rig.Send(telegram);
+            for (int loop{ 0 }; processed.count == num_processed && loop < 100000; ++loop) {
+                rig.p1.loop();
+                ++result.loops;
+            }
+            if (processed.count == num_processed) break;
+            result.read_us += Microseconds(received_time - start_time);
+            result.process_us += Microseconds(processed_time - received_time);
+            result.published += num_published - published;
+            ++result.messages;
+            // Back to waiting for the next message
+            rig.p1.loop();
+        }
+        use_real_clock(false);
+        return result;
+    }
+
+    void Report(char const *name, size_t size, Result const &result)
+    {
+        if (result.messages == 0) {
+            std::printf("%-24s %6zu bytes: no message verified\n", name, size);
+            return;
+        }
+        double const n{ static_cast<double>(result.messages) };
+        double const total_us{ (result.read_us + result.process_us) / n };
+        std::printf("%-24s %6zu bytes %8.1f us read %8.1f us process %6.1f loops %5.1f published %8.2f MB/s\n",
+            name, size, result.read_us / n, result.process_us / n, result.loops / n, result.published / n, size / total_us);
+    }
+
+    // From the arrival of the end of the message, "!" and the CRC, to the first value published.
+    // The rest of the message has already been read.
+    double EndLatency(std::string const &telegram, int num_messages)
+    {
+        Rig &rig{ *new Rig{ 0, 4096 } };
+        rig.Start();
+        use_real_clock(true);
+        size_t const end_length{ 7 };
+        double total_us{ 0 };
+        int num_measured{ 0 };
+        for (int n{ 0 }; n < num_messages; ++n) {
+            rig.Send(telegram.substr(0, telegram.size() - end_length));
+            for (int loop{ 0 }; loop < 10; ++loop) rig.p1.loop();
+            int const published{ num_published };
+            Clock::time_point const start_time{ Clock::now() };
+            rig.Send(telegram.substr(telegram.size() - end_length));
+            for (int loop{ 0 }; num_published == published && loop < 100000; ++loop) rig.p1.loop();
+            if (num_published == published) continue;
+            total_us += Microseconds(Clock::now() - start_time);
+            ++num_measured;
+            for (int loop{ 0 }; loop < 10; ++loop) rig.p1.loop();
+        }
+        use_real_clock(false);
+        return num_measured == 0 ? 0 : total_us / num_measured;
+    }
+
+    // The CRC as it was calculated over the whole message in VERIFYING_CRC, before the CRC
+    // was updated while the message is received.
+    double BitwiseCrc(std::string const &telegram, int num_messages)
+    {
+        size_t const length{ telegram.rfind('!') + 1 };
+        volatile uint16_t crc{ 0 };
+        Clock::time_point const start_time{ Clock::now() };
+        for (int n{ 0 }; n < num_messages; ++n) crc = AsciiCrc(telegram.data(), length);
+        return Microseconds(Clock::now() - start_time) / num_messages;
+    }
+
+}
+
+int main(int argc, char **argv)
+{
+    int num_messages{ 2000 };
+    for (int i{ 1 }; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quick") == 0) num_messages = 20;
+        else num_messages = std::atoi(argv[i]);
+    }
+
+    std::printf("%d messages each\n", num_messages);
+    bool all_verified{ true };
+    for (std::string const &name : TelegramNames()) {
+        std::string const telegram{ ReadTelegram(name.c_str()) };
+        Result const result{ Replay(telegram, num_messages) };
+        Report(name.c_str(), telegram.size(), result);
+        all_verified = all_verified && result.messages == num_messages;
+    }
+
+    // The CRC is updated while a message is received, so what is left at its end is the
+    // comparison, processing and publishing. Before, it also included the CRC over the whole
+    // message, in one call to loop().
+    std::string const large{ LargeAsciiTelegram(0, 3072) };
+    Result const result{ Replay(large, num_messages) };
+    Report("3 KB message", large.size(), result);
+    all_verified = all_verified && result.messages == num_messages;
+    std::printf("3 KB message: %.1f us from the end of the message to the first value published, a bitwise CRC over the message takes %.1f us\n",
+        EndLatency(large, num_messages), BitwiseCrc(large, num_messages));
+    return all_verified ? 0 : 1;
+}
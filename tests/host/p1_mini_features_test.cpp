@@ -0,0 +1,427 @@
+// Tests of the optional features, built with all of them enabled. Like p1_mini_test, each
+// test runs in a process of its own.
+
+#include "host.h"
+#include "p1_mini_history.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace esphome;
+using namespace esphome::host;
+using namespace esphome::p1_mini;
+
+namespace {
+
+    uint8_t SequenceByte(size_t index) { return static_cast<uint8_t>(index * 31 + (index >> 8)); }
+
+    // One thread writes a sequence of bytes in chunks of random sizes while another reads it
+    // in chunks of other sizes. The ring is small so it wraps and fills up all the time.
+    void TestRing()
+    {
+        size_t const num_bytes{ 2000000 };
+        P1MiniRing ring{ 61 };
+        std::atomic<bool> overfilled{ false };
+        std::thread writer{ [&ring, &overfilled]() {
+            std::minstd_rand random{ 1 };
+            uint8_t chunk[100];
+            for (size_t written{ 0 }; written < num_bytes;) {
+                size_t const length{ std::min<size_t>(random() % sizeof(chunk) + 1, num_bytes - written) };
+                for (size_t i{ 0 }; i < length; ++i) chunk[i] = SequenceByte(written + i);
+                size_t const free{ ring.Free() };
+                size_t const num_written{ ring.Write(chunk, length) };
+                // The reader only makes room, so at least what was free can be written
+                if (num_written < std::min(length, free) || 61 < ring.Available()) overfilled = true;
+                written += num_written;
+                if (num_written == 0) std::this_thread::yield();
+            }
+            } };
+
+        std::minstd_rand random{ 2 };
+        uint8_t chunk[100];
+        size_t num_read{ 0 };
+        size_t num_empty{ 0 };
+        while (num_read < num_bytes) {
+            size_t const length{ random() % sizeof(chunk) + 1 };
+            size_t const available{ ring.Available() };
+            size_t const num_chunk{ ring.Read(chunk, length) };
+            // The writer only adds data, so at least what was available can be read
+            HOST_CHECK(std::min(length, available) <= num_chunk && num_chunk <= length);
+            for (size_t i{ 0 }; i < num_chunk; ++i) HOST_CHECK(chunk[i] == SequenceByte(num_read + i));
+            num_read += num_chunk;
+            if (num_chunk == 0) {
+                ++num_empty;
+                std::this_thread::yield();
+            }
+        }
+        writer.join();
+        std::printf("%zu bytes, ring empty %zu times\n", num_read, num_empty);
+        HOST_CHECK(!overfilled);
+        HOST_CHECK(ring.Available() == 0 && ring.Free() == 61);
+    }
+
+    // The reader task moves the data from the UART to the ring while loop() is sometimes held
+    // up, with the real clock.
+    void TestReaderTask()
+    {
+        Rig &rig{ *new Rig };
+        UpdateProcessedTrigger processed;
+        rig.p1.register_update_processed_trigger(&processed);
+        rig.p1.set_reader_task(true);
+        rig.Start();
+        use_real_clock(true);
+
+        int const num_messages{ 20 };
+        std::thread sender{ [&rig]() {
+            for (int n{ 0 }; n < num_messages; ++n) {
+                std::string const telegram{ AsciiTelegram(n) };
+                for (size_t position{ 0 }; position < telegram.size(); position += 64) {
+                    rig.Send(telegram.substr(position, 64));
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            } };
+        auto const end_time{ std::chrono::steady_clock::now() + std::chrono::seconds(10) };
+        for (int loop{ 0 }; processed.count < num_messages && std::chrono::steady_clock::now() < end_time; ++loop) {
+            rig.p1.loop();
+            if (loop % 50 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            else std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        sender.join();
+        use_real_clock(false);
+        std::printf("%d of %d messages processed\n", processed.count, num_messages);
+        HOST_CHECK(processed.count == num_messages);
+        HOST_CHECK(rig.Sensor("1.8.0").state == AsciiValues(AsciiTelegram(num_messages - 1)).at(Obis("1.8.0")));
+    }
+
+    // A client of the TCP server on the loopback interface. A small receive buffer makes it
+    // fill up after a few KB when it is not read.
+    class TcpClient {
+    public:
+        explicit TcpClient(uint16_t port, int receive_buffer_size = 0)
+        {
+            m_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            HOST_CHECK(m_fd >= 0);
+            if (receive_buffer_size != 0) HOST_CHECK(::setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size, sizeof(receive_buffer_size)) == 0);
+            struct sockaddr_in address {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(port);
+            HOST_CHECK(::connect(m_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0);
+            fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+        }
+        ~TcpClient() { ::close(m_fd); }
+
+        // Everything received so far. Closed once the server has closed the connection.
+        std::string Receive()
+        {
+            char buffer[4096];
+            for (;;) {
+                ssize_t const received{ ::read(m_fd, buffer, sizeof(buffer)) };
+                if (received > 0) m_received.append(buffer, received);
+                else {
+                    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) closed = true;
+                    return m_received;
+                }
+            }
+        }
+
+        bool closed{ false };
+
+    private:
+        int m_fd;
+        std::string m_received;
+    };
+
+    bool CanConnect(uint16_t port)
+    {
+        int const fd{ ::socket(AF_INET, SOCK_STREAM, 0) };
+        HOST_CHECK(fd >= 0);
+        struct sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        bool const connected{ ::connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0 };
+        ::close(fd);
+        return connected;
+    }
+
+    // The server only listens once the network is up. Every verified message is sent whole
+    // to each client connected when it starts, and no more clients than the maximum are
+    // accepted.
+    void TestTcpServer()
+    {
+        uint16_t const port{ 18638 };
+        Rig &rig{ *new Rig };
+        rig.p1.set_tcp_server(new P1MiniTcpServer{ port, 2 });
+        network_connected = false;
+        rig.Start();
+        HOST_CHECK(!CanConnect(port));
+        network_connected = true;
+        rig.Run(1);
+
+        TcpClient first{ port };
+        rig.Run(10);
+        std::string expected_first, expected_second;
+        TcpClient *second{ nullptr };
+        for (int n{ 0 }; n < 6; ++n) {
+            std::string const telegram{ AsciiTelegram(n) };
+            rig.Send(telegram.substr(0, 300));
+            rig.Run(20);
+            // Connected while the message is being received, so it gets the whole of it
+            if (n == 2) second = new TcpClient{ port };
+            rig.Run(20);
+            rig.Send(telegram.substr(300));
+            rig.Run(300);
+            expected_first += telegram;
+            if (second != nullptr) expected_second += telegram;
+            // One message with a bad CRC, that is not sent
+            if (n == 3) {
+                rig.Send(AsciiTelegram(n, true));
+                rig.Run(2000);
+            }
+        }
+        HOST_CHECK(first.Receive() == expected_first);
+        HOST_CHECK(second->Receive() == expected_second && !second->closed);
+
+        TcpClient third{ port };
+        rig.Run(10);
+        third.Receive();
+        HOST_CHECK(third.closed);
+
+        // Once a client has gone, there is room for another one
+        delete second;
+        rig.Send(AsciiTelegram(6));
+        rig.Run(300);
+        TcpClient fourth{ port };
+        rig.Run(10);
+        rig.Send(AsciiTelegram(7));
+        rig.Run(300);
+        HOST_CHECK(fourth.Receive() == AsciiTelegram(7) && !fourth.closed);
+        HOST_CHECK(first.Receive() == expected_first + AsciiTelegram(6) + AsciiTelegram(7));
+    }
+
+    // A client that never reads misses messages, or is disconnected when it has received
+    // part of one, while another client still gets every message whole. loop() does not
+    // wait for the slow client: the test would hang if it did, as the client is only read
+    // at the end.
+    void TestTcpSlowClient()
+    {
+        uint16_t const port{ 18639 };
+        Rig &rig{ *new Rig{ 0, 4096 } };
+        rig.p1.set_tcp_server(new P1MiniTcpServer{ port, 2 });
+        int num_dropped{ 0 };
+        int num_disconnected{ 0 };
+        log_callback = [&](int, char const *message) {
+            if (std::strstr(message, "message dropped") != nullptr) ++num_dropped;
+            if (std::strstr(message, "too slow to receive") != nullptr) ++num_disconnected;
+            };
+        rig.Start();
+
+        TcpClient fast{ port };
+        TcpClient slow{ port, 1024 };
+        rig.Run(10);
+        std::vector<std::string> telegrams;
+        std::string expected;
+        for (int n{ 0 }; n < 30; ++n) {
+            telegrams.push_back(LargeAsciiTelegram(n, 3000));
+            expected += telegrams.back();
+            rig.Send(telegrams.back());
+            rig.Run(300);
+            fast.Receive();
+        }
+        log_callback = nullptr;
+        std::printf("%d messages sent, %d dropped, %d disconnected\n", static_cast<int>(telegrams.size()), num_dropped, num_disconnected);
+        HOST_CHECK(num_dropped + num_disconnected > 0);
+        HOST_CHECK(fast.Receive() == expected && !fast.closed);
+
+        // The slow client got whole messages, in order, and part of one more only when it was
+        // disconnected
+        std::string const received{ slow.Receive() };
+        size_t position{ 0 };
+        size_t num_received{ 0 };
+        for (std::string const &telegram : telegrams) {
+            if (received.compare(position, telegram.size(), telegram) != 0) continue;
+            position += telegram.size();
+            ++num_received;
+        }
+        std::printf("slow client: %u whole messages, %u bytes of a partial one\n", static_cast<unsigned>(num_received), static_cast<unsigned>(received.size() - position));
+        HOST_CHECK(num_received < telegrams.size());
+        HOST_CHECK(position == received.size() || (num_disconnected == 1 && slow.closed));
+        HOST_CHECK(slow.closed == (num_disconnected == 1));
+    }
+
+    // The rows of a CSV history response, without the header
+    std::vector<std::string> HistoryRows(web_server_base::WebServerBase &base, std::map<std::string, std::string> params)
+    {
+        AsyncWebServerRequest request{ "/p1_mini/history", std::move(params) };
+        HOST_CHECK(base.handler->canHandle(&request));
+        base.handler->handleRequest(&request);
+        std::vector<std::string> rows;
+        for (size_t start{ request.response.find("\r\n") }; start != std::string::npos && start + 2 < request.response.size();) {
+            size_t const end{ request.response.find("\r\n", start + 2) };
+            HOST_CHECK(end != std::string::npos);
+            rows.push_back(request.response.substr(start + 2, end - start - 2));
+            start = end;
+        }
+        return rows;
+    }
+
+    // Fills a history with messages in which power jumps by hundreds of watts, and returns all
+    // of its rows
+    std::vector<std::string> HistoryOfMessages(float power_resolution, float voltage_resolution)
+    {
+        Rig &rig{ *new Rig };
+        web_server_base::WebServerBase &base{ *new web_server_base::WebServerBase };
+        auto *const history{ new P1MiniHistory{ &base, "/p1_mini/history", 3072 } };
+        history->add_obis_code(Obis("1.8.0"));
+        history->add_obis_code(Obis("1.7.0"), power_resolution);
+        history->add_obis_code(Obis("32.7.0"), voltage_resolution);
+        rig.p1.set_history(history);
+        rig.Start();
+        for (int n{ 0 }; n < 1000; ++n) {
+            rig.Send(AsciiTelegram(n * 137));
+            rig.Run(5);
+            advance_clock(995);
+        }
+        std::vector<std::string> rows;
+        for (int start{ 0};; start += 500) {
+            std::vector<std::string> const page{ HistoryRows(base, { { "start", std::to_string(start) } }) };
+            rows.insert(rows.end(), page.begin(), page.end());
+            if (page.size() < 500) return rows;
+        }
+    }
+
+    // With a resolution, power and voltage are kept rounded to it, and the same storage holds
+    // more messages. The counter stays exact.
+    void TestHistoryResolution()
+    {
+        std::vector<std::string> const exact{ HistoryOfMessages(0.0f, 0.0f) };
+        std::vector<std::string> const rounded{ HistoryOfMessages(0.1f, 1.0f) };
+        std::printf("%zu messages exactly, %zu rounded\n", exact.size(), rounded.size());
+        HOST_CHECK(exact.size() < rounded.size());
+        for (size_t i{ 0 }; i < rounded.size(); ++i) {
+            std::map<uint32_t, float> const values{ AsciiValues(AsciiTelegram(static_cast<int>(1000 - rounded.size() + i) * 137)) };
+            // Halves round away from zero
+            long const power{ std::lround(values.at(Obis("1.7.0")) * 1000) };
+            long const voltage{ std::lround(values.at(Obis("32.7.0")) * 10) };
+            char row[128];
+            std::snprintf(row, sizeof(row), ",%.3f,%ld.%03ld,%ld.0", values.at(Obis("1.8.0")), (power + 50) / 1000, (power + 50) % 1000 / 100 * 100, (voltage + 5) / 10);
+            std::string const &actual{ rounded[i] };
+            HOST_CHECK(actual.size() > std::strlen(row) && actual.compare(actual.size() - std::strlen(row), std::strlen(row), row) == 0);
+        }
+    }
+
+    // The history returns the values of the last messages as received, a limited number of
+    // rows at a time, also while messages are added from another thread.
+    void TestHistory()
+    {
+        Rig &rig{ *new Rig };
+        web_server_base::WebServerBase base;
+        auto *const history{ new P1MiniHistory{ &base, "/p1_mini/history", 3072 } };
+        for (char const *obis_code : { "1.8.0", "1.7.0", "32.7.0" }) history->add_obis_code(Obis(obis_code));
+        rig.p1.set_history(history);
+        // Samples are kept before the network is up, but only served after
+        network_connected = false;
+        rig.Start();
+        rig.Send(AsciiTelegram(0));
+        rig.Run(300);
+        HOST_CHECK(base.handler == nullptr);
+        network_connected = true;
+        rig.Run(1);
+        HOST_CHECK(base.handler == history);
+        HOST_CHECK(HistoryRows(base, {}).size() == 1);
+
+        std::vector<std::string> expected;
+        for (int n{ 0 }; n < 1000; ++n) {
+            std::string const telegram{ AsciiTelegram(n * 7) };
+            rig.Send(telegram);
+            rig.Run(5);
+            advance_clock(995 + n % 3);
+            std::map<uint32_t, float> const values{ AsciiValues(telegram) };
+            char row[128];
+            std::snprintf(row, sizeof(row), ",%.3f,%.3f,%.1f", values.at(Obis("1.8.0")), values.at(Obis("1.7.0")), values.at(Obis("32.7.0")));
+            expected.push_back(row);
+        }
+
+        // The oldest rows are dropped as the storage fills up, and the rest are returned in pages
+        std::vector<std::string> rows;
+        for (int start{ 0 };; start += 500) {
+            std::vector<std::string> const page{ HistoryRows(base, { { "start", std::to_string(start) }, { "count", "1000" } }) };
+            HOST_CHECK(page.size() <= 500);
+            rows.insert(rows.end(), page.begin(), page.end());
+            if (page.size() < 500) break;
+        }
+        std::printf("%zu of %zu messages in the history\n", rows.size(), expected.size());
+        HOST_CHECK(100 < rows.size() && rows.size() < expected.size());
+        for (size_t i{ 0 }; i < rows.size(); ++i) {
+            std::string const &row{ rows[i] };
+            std::string const &values{ expected[expected.size() - rows.size() + i] };
+            HOST_CHECK(row.size() > values.size() && row.compare(row.size() - values.size(), values.size(), values) == 0);
+        }
+        HOST_CHECK(HistoryRows(base, { { "start", "10" }, { "count", "3" } }) == std::vector<std::string>(rows.begin() + 10, rows.begin() + 13));
+
+        // Requests from another thread, as from the web server task on the ESP32
+        std::atomic<bool> done{ false };
+        std::atomic<int> num_requests{ 0 };
+        std::thread requests{ [&]() {
+            while (!done) {
+                for (std::string const &row : HistoryRows(base, { { "count", "500" } })) {
+                    HOST_CHECK(std::count(row.begin(), row.end(), ',') == 3);
+                }
+                ++num_requests;
+            }
+            } };
+        for (int n{ 1000 }; n < 2000; ++n) {
+            rig.Send(AsciiTelegram(n * 7));
+            rig.Run(5);
+            advance_clock(995);
+        }
+        done = true;
+        requests.join();
+        std::printf("%d requests while adding messages\n", num_requests.load());
+        HOST_CHECK(num_requests > 0);
+    }
+
+    struct Test {
+        char const *name;
+        void (*run)();
+    };
+
+    Test const tests[]{
+        { "ring", TestRing },
+        { "reader_task", TestReaderTask },
+        { "tcp_server", TestTcpServer },
+        { "tcp_slow_client", TestTcpSlowClient },
+        { "history", TestHistory },
+        { "history_resolution", TestHistoryResolution },
+    };
+
+}
+
+int main(int argc, char **argv)
+{
+    for (Test const &test : tests) {
+        if (argc == 1) std::printf("%s\n", test.name);
+        else if (std::strcmp(argv[1], test.name) == 0) {
+            test.run();
+            std::printf("%s passed\n", test.name);
+            return 0;
+        }
+    }
+    if (argc == 1) return 0;
+    std::printf("Unknown test %s\n", argv[1]);
+    return 1;
+}
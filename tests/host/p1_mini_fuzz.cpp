@@ -0,0 +1,245 @@
+// Feeds malformed ASCII and binary messages to the component, looking for crashes and for
+// calls to loop() that do more work than the 25 ms the processing states are meant to keep to
+// allow. Work is counted, not timed, so the result does not depend on the host or on what
+// else runs on it: the bytes read from the UART, plus the steps of the processing states,
+// which read the clock after every line or data element. The simulated clock does not move
+// within a loop(), so a loop() processes all of a message, and no loop() should handle more
+// than one buffer of bytes and a step for each line or element in it.
+//
+// The first byte of an input holds options, the rest is what the meter sends:
+//   bit 0       fix the CRC (and for HDLC the length) so the message gets past the check
+//   bit 1       fast_resync
+//   bits 2 - 7  size of the chunks the data arrives in, in 16 byte steps
+//
+// Built with -DP1_MINI_LIBFUZZER=ON (clang) this is a libFuzzer target. Otherwise it runs the
+// inputs in the given files and directories, then the given number of random mutations of
+// the messages from host.h, and shows the inputs with the most work in a loop():
+//   p1_mini_fuzz [--buffer N] [--mutations N] [--slowest N] [--dump N ...] [file or directory ...]
+// --dump writes mutation N to mutation-N.bin, to add it to the corpus. It can be repeated.
+// --buffer sets the size of the message buffer (3072 bytes by default), to run inputs that
+// fill it exactly. It must come before the files.
+
+#include "host.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <sys/stat.h>
+
+using namespace esphome;
+using namespace esphome::host;
+using namespace esphome::p1_mini;
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+    int buffer_size{ 3072 };
+    // A line or data element takes at least two bytes, so this is a buffer of bytes and a
+    // step for each of them. Anything more means part of the message is gone through again.
+    uint32_t MaxWorkPerLoop() { return 2 * buffer_size; }
+
+    // The work of a loop() that has nothing to do, taken off the work of the others
+    uint32_t idle_work{ 0 };
+
+    Rig &GetRig()
+    {
+        static Rig *rig{ nullptr };
+        if (rig == nullptr) {
+            // Malformed messages are all logged, which would drown out what is found
+            log_level = LOG_NONE;
+            rig = new Rig{ 0, buffer_size };
+            rig->Start();
+            uint32_t const millis_calls{ num_millis_calls };
+            rig->p1.loop();
+            idle_work = num_millis_calls - millis_calls;
+        }
+        return *rig;
+    }
+
+    struct InputResult {
+        uint32_t most_work{ 0 }; // In a single loop()
+        int busy_loops{ 0 }; // Calls to loop() with more work than an idle one
+        int loops{ 0 };
+        double longest_ms{ 0 }; // Wall time, only shown as it depends on the host
+    };
+
+    // Makes the message end as one with a valid CRC would, so its content is processed
+    void FixCrc(std::string &data)
+    {
+        if (data.size() >= 6 && static_cast<uint8_t>(data[0]) == 0x7e) {
+            std::vector<uint8_t> frame{ data.begin(), data.end() - 3 };
+            frame = FinishBinaryTelegram(frame);
+            data.assign(frame.begin(), frame.end());
+        }
+        else if (!data.empty() && data[0] == '/') {
+            size_t const end{ data.rfind('!') };
+            if (end != std::string::npos) data = FinishAsciiTelegram(data.substr(0, end + 1));
+        }
+    }
+
+    // Runs one input and returns the work of its loop() calls
+    InputResult RunInput(uint8_t const *input, size_t size)
+    {
+        InputResult result;
+        if (size == 0) return result;
+        uint8_t const options{ input[0] };
+        std::string data{ reinterpret_cast<char const *>(input + 1), size - 1 };
+        if (options & 1) FixCrc(data);
+        size_t const chunk_size{ 1 + (options >> 2) * 16u };
+
+        Rig &rig{ GetRig() };
+        rig.p1.set_fast_resync((options & 2) != 0);
+        auto loop = [&rig, &result]() {
+            size_t const num_read{ rig.uart.num_read };
+            uint32_t const millis_calls{ num_millis_calls };
+            Clock::time_point const start_time{ Clock::now() };
+            rig.p1.loop();
+            result.longest_ms = std::max(result.longest_ms, std::chrono::duration<double, std::milli>(Clock::now() - start_time).count());
+            uint32_t const work{ static_cast<uint32_t>(rig.uart.num_read - num_read) + num_millis_calls - millis_calls };
+            result.most_work = std::max(result.most_work, work);
+            if (work > idle_work) ++result.busy_loops;
+            ++result.loops;
+            advance_clock(1);
+            };
+        for (size_t position{ 0 }; position < data.size(); position += chunk_size) {
+            rig.Send(data.substr(position, chunk_size));
+            loop();
+        }
+        // Long enough for the timeouts, so the next input starts from waiting for a message
+        for (int i{ 0 }; i < 1500; ++i) loop();
+        return result;
+    }
+
+}
+
+#ifdef P1_MINI_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size)
+{
+    if (RunInput(data, size).most_work > MaxWorkPerLoop()) __builtin_trap();
+    return 0;
+}
+
+#else
+
+namespace {
+
+    struct NamedResult {
+        std::string name;
+        InputResult result;
+    };
+    // The inputs with the most work in a loop(), the most first
+    std::vector<NamedResult> slowest;
+    size_t num_slowest{ 10 };
+
+    void Print(NamedResult const &input)
+    {
+        std::printf("%s: %u bytes and steps in one loop(), %d of %d loop() calls busy, longest %.2f ms\n",
+            input.name.c_str(), input.result.most_work, input.result.busy_loops, input.result.loops, input.result.longest_ms);
+    }
+
+    bool RunAndReport(std::string const &name, std::string const &input)
+    {
+        NamedResult const named{ name, RunInput(reinterpret_cast<uint8_t const *>(input.data()), input.size()) };
+        auto const position{ std::find_if(slowest.begin(), slowest.end(), [&named](NamedResult const &other) {
+            return other.result.most_work < named.result.most_work || (other.result.most_work == named.result.most_work && other.result.busy_loops < named.result.busy_loops);
+            }) };
+        slowest.insert(position, named);
+        if (slowest.size() > num_slowest) slowest.pop_back();
+        if (named.result.most_work <= MaxWorkPerLoop()) return true;
+        std::printf("over the budget of %u: ", MaxWorkPerLoop());
+        Print(named);
+        return false;
+    }
+
+    bool RunPath(std::string const &path)
+    {
+        struct stat status;
+        HOST_CHECK(stat(path.c_str(), &status) == 0);
+        if (S_ISDIR(status.st_mode)) {
+            std::vector<std::string> names;
+            DIR *const dir{ opendir(path.c_str()) };
+            while (dirent const *const entry = readdir(dir)) {
+                if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+            }
+            closedir(dir);
+            std::sort(names.begin(), names.end());
+            bool passed{ true };
+            for (std::string const &name : names) passed = RunPath(path + "/" + name) && passed;
+            return passed;
+        }
+        std::ifstream file{ path, std::ios::binary };
+        std::stringstream data;
+        data << file.rdbuf();
+        return RunAndReport(path, data.str());
+    }
+
+    // Flips, removes and inserts bytes, with long runs of digits and separators for ASCII
+    std::string Mutation(int n, std::minstd_rand &random)
+    {
+        std::string data;
+        if (random() % 2) {
+            data = AsciiTelegram(n);
+            for (int k{ 0 }, num_changes = 1 + random() % 8; k < num_changes; ++k) {
+                size_t const position{ random() % data.size() };
+                switch (random() % 4) {
+                case 0: data[position] = static_cast<char>(random()); break;
+                case 1: data.erase(position, 1 + random() % 5); break;
+                case 2: data.insert(position, std::string(1 + random() % 3000, "0123456789.(:-*"[random() % 15])); break;
+                default: data.insert(position, 1, "\r\n!()0"[random() % 6]); break;
+                }
+                if (data.empty()) data = "/";
+            }
+        }
+        else {
+            std::vector<uint8_t> const frame{ BinaryTelegram(n) };
+            data.assign(frame.begin(), frame.end());
+            for (int k{ 0 }, num_changes = 1 + random() % 6; k < num_changes && data.size() > 6; ++k) {
+                size_t const position{ 1 + random() % (data.size() - 4) };
+                switch (random() % 3) {
+                case 0: data[position] = static_cast<char>(random()); break;
+                case 1: data.erase(position, 1); break;
+                default: data.insert(position, 1, static_cast<char>(random())); break;
+                }
+            }
+        }
+        // Mostly with the CRC fixed, as otherwise the content is never looked at
+        uint8_t const options{ static_cast<uint8_t>((random() % 4 != 0 ? 1 : 0) | (random() % 2) << 1 | (random() % 64) << 2) };
+        return static_cast<char>(options) + data;
+    }
+
+}
+
+int main(int argc, char **argv)
+{
+    int num_mutations{ 0 };
+    std::vector<int> dump;
+    bool passed{ true };
+    for (int i{ 1 }; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--mutations") == 0 && i + 1 < argc) num_mutations = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--buffer") == 0 && i + 1 < argc) buffer_size = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--slowest") == 0 && i + 1 < argc) num_slowest = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--dump") == 0 && i + 1 < argc) dump.push_back(std::atoi(argv[++i]));
+        else passed = RunPath(argv[i]) && passed;
+    }
+
+    std::minstd_rand random{ 1 };
+    for (int n{ 0 }; n < num_mutations; ++n) {
+        std::string const input{ Mutation(n, random) };
+        if (std::find(dump.begin(), dump.end(), n) != dump.end()) {
+            std::ofstream{ "mutation-" + std::to_string(n) + ".bin", std::ios::binary } << input;
+        }
+        passed = RunAndReport("mutation " + std::to_string(n), input) && passed;
+    }
+    std::printf("slowest inputs:\n");
+    for (NamedResult const &input : slowest) Print(input);
+    std::printf("%d values published\n", num_published);
+    std::printf("%s\n", passed ? "no loop() over the budget" : "loop() over the budget");
+    return passed ? 0 : 1;
+}
+
+#endif // P1_MINI_LIBFUZZER
@@ -0,0 +1,141 @@
+// Load generator: a simulated meter sends messages to the component for a while, with the
+// simulated clock, and the outcome is reported. Fails if a value was published from a
+// message other than the last one sent intact, or if more intact messages were missed than
+// there were damaged ones, apart from those lost while an automatic buffer grows.
+//   p1_mini_sim [options]
+//     --binary             HDLC frames instead of ASCII messages
+//     --size N             pad ASCII messages to about N bytes
+//     --period MS          from the start of one message to the next (1000)
+//     --jitter MS          added to each period, up to this much (0)
+//     --baud N             serial speed, 0 to send each message at once (115200)
+//     --bit-error-rate X   chance of each bit being flipped (0)
+//     --rts MS             only send when asked for, with minimum_period MS
+//     --uart-buffer N      bytes the UART holds between loops, 0 for no limit (256)
+//     --loop-interval MS   time between calls to loop() (1)
+//     --buffer N           message buffer size, 0 for auto (3072)
+//     --fast-resync
+//     --minutes N          simulated time (10)
+//     --seed N
+
+#include "meter_sim.h"
+
+#include <chrono>
+#include <cstring>
+
+using namespace esphome;
+using namespace esphome::host;
+using namespace esphome::p1_mini;
+
+int main(int argc, char **argv)
+{
+    MeterOptions options;
+    options.uart_buffer_size = 256; // As in ESPHome by default
+    uint32_t min_period_ms{ 0 };
+    int loop_interval_ms{ 1 };
+    int buffer_size{ 3072 };
+    bool fast_resync{ false };
+    int minutes{ 10 };
+    for (int i{ 1 }; i < argc; ++i) {
+        std::string const option{ argv[i] };
+        auto value = [&]() -> char const * {
+            if (i + 1 == argc) {
+                std::printf("%s needs a value\n", option.c_str());
+                std::exit(2);
+            }
+            return argv[++i];
+            };
+        if (option == "--binary") options.binary = true;
+        else if (option == "--size") options.size = std::atoi(value());
+        else if (option == "--period") options.period_ms = std::atoi(value());
+        else if (option == "--jitter") options.jitter_ms = std::atoi(value());
+        else if (option == "--baud") options.baud_rate = std::atoi(value());
+        else if (option == "--bit-error-rate") options.bit_error_rate = std::atof(value());
+        else if (option == "--rts") {
+            options.rts = true;
+            min_period_ms = std::atoi(value());
+        }
+        else if (option == "--uart-buffer") options.uart_buffer_size = std::atoi(value());
+        else if (option == "--loop-interval") loop_interval_ms = std::max(std::atoi(value()), 1);
+        else if (option == "--buffer") buffer_size = std::atoi(value());
+        else if (option == "--fast-resync") fast_resync = true;
+        else if (option == "--minutes") minutes = std::atoi(value());
+        else if (option == "--seed") options.seed = std::atoi(value());
+        else {
+            std::printf("Unknown option %s\n", option.c_str());
+            return 2;
+        }
+    }
+
+    log_level = LOG_NONE;
+    Rig &rig{ *new Rig{ min_period_ms, buffer_size } };
+    rig.p1.set_fast_resync(fast_resync);
+    sensor::Sensor crc_errors, buffer_overruns, format_errors, timeouts, unrequested_data, uart_backlog;
+    rig.p1.set_diagnostics_interval(1000);
+    rig.p1.set_crc_errors_sensor(&crc_errors);
+    rig.p1.set_buffer_overruns_sensor(&buffer_overruns);
+    rig.p1.set_format_errors_sensor(&format_errors);
+    rig.p1.set_timeouts_sensor(&timeouts);
+    rig.p1.set_unrequested_data_sensor(&unrequested_data);
+    rig.p1.set_uart_backlog_sensor(&uart_backlog);
+    SimulatedMeter meter{ rig.uart, options };
+    meter.Connect(rig.p1);
+
+    // Each processed message must be the last one the meter sent, and sent intact
+    int num_processed{ 0 };
+    int num_wrong{ 0 };
+    int32_t last_processed{ -1 };
+    UpdateProcessedTrigger processed;
+    processed.callback = [&]() {
+        ++num_processed;
+        P1MiniValue energy;
+        if (!rig.p1.get_snapshot_value(Obis("1.8.0"), energy) || energy.mantissa != meter.LastEnergy() || !meter.LastIntact()) ++num_wrong;
+        last_processed = energy.mantissa;
+        };
+    rig.p1.register_update_processed_trigger(&processed);
+
+    rig.Start();
+    int num_missed{ 0 };
+    int num_sent{ 0 };
+    float max_uart_backlog{ 0 };
+    double longest_loop_us{ 0 };
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point const start_time{ Clock::now() };
+    int32_t last_sent{ -1 };
+    bool last_sent_intact{ false };
+    int num_damaged{ 0 }; // Any bit errors or bytes lost
+    for (int ms{ 0 }; ms < minutes * 60000; ++ms) {
+        meter.Run(millis());
+        // An intact message that was not processed by the time the next one starts is missed
+        if (meter.num_sent != num_sent) {
+            if (last_sent_intact && last_processed != last_sent) ++num_missed;
+            num_sent = meter.num_sent;
+        }
+        if (meter.LastEnergy() != last_sent) {
+            last_sent = meter.LastEnergy();
+            last_sent_intact = meter.LastIntact();
+            if (meter.LastDamaged()) ++num_damaged;
+        }
+        if (ms % loop_interval_ms == 0) {
+            Clock::time_point const loop_start{ Clock::now() };
+            rig.p1.loop();
+            longest_loop_us = std::max(longest_loop_us, std::chrono::duration<double, std::micro>(Clock::now() - loop_start).count());
+            max_uart_backlog = std::max(max_uart_backlog, uart_backlog.state);
+        }
+        advance_clock(1);
+    }
+    double const run_time{ std::chrono::duration<double>(Clock::now() - start_time).count() };
+
+    std::printf("%d messages sent in %d simulated minutes (%.1f s), %d with bit errors, %zu bytes lost in the UART\n",
+        meter.num_sent, minutes, run_time, meter.num_corrupted, meter.num_bytes_lost);
+    std::printf("%d damaged, %d processed, %d intact messages missed, %d wrong\n", num_damaged, num_processed, num_missed, num_wrong);
+    std::printf("errors: %.0f CRC, %.0f buffer overruns, %.0f format, %.0f timeouts, %.0f unrequested data\n",
+        crc_errors.state, buffer_overruns.state, format_errors.state, timeouts.state, unrequested_data.state);
+    std::printf("largest UART backlog %.0f bytes, longest loop() %.0f us\n", max_uart_backlog, longest_loop_us);
+
+    // A damaged message can take the next one with it, such as when its end is lost. An
+    // automatic buffer is doubled from 1 KB on each overrun, up to 32 KB, losing those messages.
+    int const num_growing{ buffer_size == 0 ? 5 : 0 };
+    bool const passed{ num_wrong == 0 && num_processed > 0 && num_missed <= num_damaged + num_growing };
+    std::printf("%s\n", passed ? "passed" : "failed");
+    return passed ? 0 : 1;
+}
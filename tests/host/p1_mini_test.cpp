@@ -0,0 +1,651 @@
+// Correctness tests of the component against the stubbed UART and clock. Each test runs in
+// a process of its own, as the component is never destroyed on the device either.
+
+#include "host.h"
+#include "p1_mini_aggregator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace esphome;
+using namespace esphome::host;
+using namespace esphome::p1_mini;
+
+namespace {
+
+    bool Near(float a, float b) { return std::fabs(a - b) <= std::fabs(b) * 1e-6f + 1e-4f; }
+
+    // Every message in the telegrams directory is verified and all of its values published
+    void TestCorpus()
+    {
+        for (std::string const &name : TelegramNames()) {
+            std::printf("%s\n", name.c_str());
+            Rig &rig{ *new Rig };
+            rig.Start();
+            std::string const telegram{ ReadTelegram(name.c_str()) };
+            rig.Send(telegram);
+            rig.Run(300);
+            if (name.compare(name.size() - 4, 4, ".bin") == 0) {
+                HOST_CHECK(Near(rig.Sensor("1.8.0").state, 6678.394f));
+                HOST_CHECK(Near(rig.Sensor("4.8.0").state, 1020.971f));
+                HOST_CHECK(Near(rig.Sensor("1.7.0").state, 1.734f));
+                HOST_CHECK(Near(rig.Sensor("32.7.0").state, 240.3f));
+                HOST_CHECK(Near(rig.Sensor("71.7.0").state, 1.7f));
+                continue;
+            }
+            std::map<uint32_t, float> const values{ AsciiValues(telegram) };
+            HOST_CHECK(!values.empty());
+            for (auto const &sensor : rig.sensors) {
+                auto const value{ values.find(sensor.first) };
+                HOST_CHECK(sensor.second->has_state() == (value != values.end()));
+                if (value != values.end()) HOST_CHECK(Near(sensor.second->state, value->second));
+            }
+            HOST_CHECK(rig.identification.state == telegram.substr(0, telegram.find('\r')));
+            HOST_CHECK(rig.clock.state.compare(0, 10, "0-0:1.0.0(") == 0);
+        }
+    }
+
+    // The sensor of each line is predicted from the previous message, and a line that moved
+    // is still matched with the search
+    void TestPrediction()
+    {
+        Rig rig;
+        int num_predicted{ -1 };
+        int num_lines{ -1 };
+        log_callback = [&](int, char const *message) {
+            char const *const counts{ std::strstr(message, "values published, ") };
+            if (counts != nullptr) HOST_CHECK(std::sscanf(counts, "values published, %d of %d lines predicted", &num_predicted, &num_lines) == 2);
+            };
+        rig.Start();
+        auto send = [&](std::string const &telegram) {
+            num_predicted = num_lines = -1;
+            rig.Send(telegram);
+            rig.Run(300);
+            std::map<uint32_t, float> const values{ AsciiValues(telegram) };
+            for (auto const &sensor : rig.sensors) HOST_CHECK(Near(sensor.second->state, values.at(sensor.first)));
+            HOST_CHECK(num_lines > 26);
+            };
+        send(AsciiTelegram(0));
+        HOST_CHECK(num_predicted == 0);
+        send(AsciiTelegram(1));
+        HOST_CHECK(num_predicted == num_lines);
+
+        // 1.7.0 and 2.7.0 swapped, in this message and the prediction for the next one
+        std::string reordered{ AsciiTelegram(2) };
+        reordered.resize(reordered.find('!') + 1);
+        size_t const first{ reordered.find("1-0:1.7.0(") };
+        size_t const second{ reordered.find("1-0:2.7.0(") };
+        std::string const line{ reordered.substr(first, second - first) };
+        reordered.erase(first, line.size());
+        reordered.insert(reordered.find("\r\n", first) + 2, line);
+        send(FinishAsciiTelegram(reordered));
+        HOST_CHECK(num_predicted == num_lines - 2);
+        send(AsciiTelegram(3));
+        HOST_CHECK(num_predicted == num_lines - 2);
+        send(AsciiTelegram(4));
+        HOST_CHECK(num_predicted == num_lines);
+
+        // A line without a sensor is predicted to match nothing again
+        auto with_frequency = [](int n) {
+            std::string telegram{ AsciiTelegram(n) };
+            telegram.resize(telegram.find('!'));
+            return FinishAsciiTelegram(telegram + "1-0:14.7.0(50.00*Hz)\r\n!");
+            };
+        send(with_frequency(5));
+        HOST_CHECK(num_predicted == num_lines - 1);
+        send(with_frequency(6));
+        HOST_CHECK(num_predicted == num_lines);
+        log_callback = nullptr;
+    }
+
+    // Messages arriving a few bytes per loop, as from a UART at 115200 baud. The values
+    // published, as logged, do not include the text sensors that did not change.
+    void TestAsciiChunks()
+    {
+        Rig rig;
+        int num_logged{ -1 };
+        log_callback = [&](int, char const *message) {
+            char const *const counts{ std::strstr(message, "bytes/s), ") };
+            if (counts != nullptr) HOST_CHECK(std::sscanf(counts, "bytes/s), %d values published", &num_logged) == 1);
+            };
+        rig.Start();
+        for (int n{ 0 }; n < 5; ++n) {
+            int const published{ num_published };
+            std::string const telegram{ AsciiTelegram(n) };
+            for (size_t i{ 0 }; i < telegram.size(); i += 12) {
+                rig.Send(telegram.substr(i, 12));
+                rig.Run(1);
+            }
+            rig.Run(200);
+            // The identification only changes with the first message
+            HOST_CHECK(num_published - published == (n == 0 ? 28 : 27));
+            HOST_CHECK(num_logged == num_published - published);
+        }
+        log_callback = nullptr;
+        HOST_CHECK(Near(rig.Sensor("1.8.0").state, 12345.004f));
+        HOST_CHECK(Near(rig.Sensor("1.7.0").state, 0.284f));
+        HOST_CHECK(Near(rig.Sensor("32.7.0").state, 230.4f));
+        HOST_CHECK(Near(rig.p1.get_value("1-0:1.8.0"), 12345.004f));
+        HOST_CHECK(Near(rig.p1.get_value(32, 7, 0), 230.4f));
+        HOST_CHECK(std::isnan(rig.p1.get_value(99, 9, 9)));
+        HOST_CHECK(rig.clock.state == "0-0:1.0.0(241004123456W)");
+    }
+
+    // An OBIS code part above what the packing holds is not taken for the sensor its masked
+    // value would match: 1.264.0 would be 1.8.0
+    void TestObisRange()
+    {
+        Rig rig;
+        rig.Start();
+        std::string message{ AsciiTelegram(1) };
+        float const expected{ AsciiValues(message).at(Obis("1.8.0")) };
+        message.resize(message.find('!') + 1);
+        message.insert(message.find("1-0:1.8.0("), "1-0:1.264.0(99999.999*kWh)\r\n");
+        rig.Send(FinishAsciiTelegram(message));
+        rig.Run(300);
+        HOST_CHECK(rig.Sensor("1.8.0").num_published == 1);
+        HOST_CHECK(Near(rig.Sensor("1.8.0").state, expected));
+    }
+
+    // A message with a bad CRC is not published, and the next one is
+    void TestBadCrc()
+    {
+        Rig rig;
+        sensor::Sensor crc_errors;
+        rig.p1.set_diagnostics_interval(1000);
+        rig.p1.set_crc_errors_sensor(&crc_errors);
+        rig.Start();
+        rig.Send(AsciiTelegram(1));
+        rig.Run(1000);
+        int const published{ rig.Sensor("1.8.0").num_published };
+        rig.Send(AsciiTelegram(2, true));
+        rig.Run(1000);
+        HOST_CHECK(rig.Sensor("1.8.0").num_published == published);
+        HOST_CHECK(crc_errors.state == 1.0f);
+        rig.Send(AsciiTelegram(3));
+        rig.Run(300);
+        HOST_CHECK(rig.Sensor("1.8.0").num_published == published + 1);
+        HOST_CHECK(Near(rig.Sensor("1.7.0").state, 0.283f));
+    }
+
+    // With streaming, a buffer smaller than the message is enough, and nothing is published
+    // from a message with a bad CRC.
+    void TestStreaming()
+    {
+        Rig rig{ 0, 512 };
+        rig.p1.set_streaming(true);
+        rig.Start();
+        for (int n{ 0 }; n < 5; ++n) {
+            int const published{ num_published };
+            std::string const telegram{ AsciiTelegram(n) };
+            for (size_t i{ 0 }; i < telegram.size(); i += 64) {
+                rig.Send(telegram.substr(i, 64));
+                rig.Run(1);
+            }
+            rig.Run(200);
+            HOST_CHECK(num_published - published == (n == 0 ? 28 : 27));
+        }
+        HOST_CHECK(Near(rig.Sensor("1.8.0").state, 12345.004f));
+        int const published{ num_published };
+        rig.Send(AsciiTelegram(7, true));
+        rig.Run(800);
+        HOST_CHECK(num_published == published);
+    }
+
+    // The layout of the first binary message is reused, and learned again when it changes
+    void TestBinary()
+    {
+        Rig rig;
+        rig.Start();
+        for (int n{ 0 }; n < 5; ++n) {
+            rig.Send(BinaryTelegram(n));
+            rig.Run(100);
+            HOST_CHECK(Near(rig.Sensor("1.8.0").state, (12345678 + n) / 1000.0f));
+            HOST_CHECK(Near(rig.Sensor("32.7.0").state, (0x090c + n % 3) / 10.0f));
+        }
+        // 1.8.0 replaced by 33.8.0, without changing the length of the message
+        std::vector<uint8_t> frame{ BinaryTelegram(5) };
+        frame[26] = 33;
+        uint16_t const crc{ BinaryCrc(frame.data() + 1, frame.size() - 4) };
+        frame[frame.size() - 3] = crc & 0xff;
+        frame[frame.size() - 2] = crc >> 8;
+        int const published{ rig.Sensor("1.8.0").num_published };
+        rig.Send(frame);
+        rig.Run(100);
+        HOST_CHECK(rig.Sensor("1.8.0").num_published == published);
+        HOST_CHECK(Near(rig.Sensor("32.7.0").state, (0x090c + 5 % 3) / 10.0f));
+    }
+
+    // Unsigned double longs above the range of int32_t keep their magnitude
+    void TestBinaryLargeValue()
+    {
+        Rig rig;
+        rig.Start();
+        for (uint32_t const energy : { 0x7fffffffu, 0x80000000u, 0xfffffffeu }) {
+            std::vector<uint8_t> frame{ BinaryTelegram(0) };
+            HOST_CHECK(frame[30] == 0x06);
+            for (int i{ 0 }; i < 4; ++i) frame[31 + i] = energy >> (24 - 8 * i);
+            uint16_t const crc{ BinaryCrc(frame.data() + 1, frame.size() - 4) };
+            frame[frame.size() - 3] = crc & 0xff;
+            frame[frame.size() - 2] = crc >> 8;
+            rig.Send(frame);
+            rig.Run(100);
+            HOST_CHECK(Near(rig.Sensor("1.8.0").state, energy / 1000.0f));
+            P1MiniValue value;
+            HOST_CHECK(rig.p1.get_snapshot_value(Obis("1.8.0"), value));
+            char text[24];
+            value.Format(text, sizeof(text));
+            std::printf("%u: %s\n", energy, text);
+            HOST_CHECK(std::strtod(text, nullptr) == (energy <= 0x7fffffffu ? energy / 1000.0 : std::round(energy / 10.0) / 100.0));
+        }
+    }
+
+    // Messages that arrive back to back, or all at once after a late loop(), are all verified
+    void TestBackToBack()
+    {
+        Rig rig;
+        UpdateProcessedTrigger processed;
+        rig.p1.register_update_processed_trigger(&processed);
+        rig.Start();
+        rig.Send(AsciiTelegram(1) + AsciiTelegram(2) + AsciiTelegram(3));
+        rig.Run(300);
+        HOST_CHECK(processed.count == 3);
+        HOST_CHECK(Near(rig.Sensor("1.7.0").state, 0.283f));
+        // The end of one message in the same chunk as the start of the next
+        std::string const telegrams{ AsciiTelegram(4) + AsciiTelegram(5) };
+        for (size_t i{ 0 }; i < telegrams.size(); i += 100) {
+            rig.Send(telegrams.substr(i, 100));
+            rig.Run(5);
+        }
+        rig.Run(300);
+        HOST_CHECK(processed.count == 5);
+        HOST_CHECK(Near(rig.Sensor("1.7.0").state, 0.285f));
+
+        std::vector<uint8_t> frames;
+        for (int n{ 0 }; n < 3; ++n) {
+            std::vector<uint8_t> const frame{ BinaryTelegram(n) };
+            frames.insert(frames.end(), frame.begin(), frame.end());
+        }
+        rig.Send(frames);
+        rig.Run(300);
+        HOST_CHECK(processed.count == 8);
+        HOST_CHECK(Near(rig.Sensor("1.8.0").state, 12345.680f));
+        HOST_CHECK(log_counts[LOG_WARN] == 0 && log_counts[LOG_ERROR] == 0);
+    }
+
+    // Publish on change, delta and max interval of the sensors
+    void TestPublishPolicy()
+    {
+        Rig rig;
+        for (auto &sensor : rig.sensors) sensor.second->set_publish_on_change(true);
+        P1MiniSensor &power{ rig.Sensor("1.7.0") };
+        power.set_publish_on_change(false);
+        power.set_delta(0.02f);
+        power.set_max_interval(3000);
+        rig.Start();
+        int const published{ num_published };
+        // Alternates between two messages, where 1.7.0 changes by 0.001 or 0.008
+        for (int n{ 0 }; n < 10; ++n) {
+            rig.Send(AsciiTelegram(n % 2 ? 0 : n));
+            rig.Run(1000);
+        }
+        HOST_CHECK(num_published - published < 10 * 28 / 2);
+        HOST_CHECK(power.num_published >= 3 && power.num_published <= 5);
+        HOST_CHECK(rig.Sensor("2.8.0").num_published == 1);
+    }
+
+    // The automatic buffer size grows for a larger message
+    void TestAutoBuffer()
+    {
+        Rig rig{ 0, 0 };
+        sensor::Sensor buffer_size;
+        rig.p1.set_diagnostics_interval(1000);
+        rig.p1.set_buffer_size_sensor(&buffer_size);
+        rig.Start();
+        int num_published_messages{ 0 };
+        for (int n{ 0 }; n < 8; ++n) {
+            std::string telegram{ AsciiTelegram(n) };
+            if (n >= 5) telegram = FinishAsciiTelegram(telegram.substr(0, 21) + std::string(900, '\n') + telegram.substr(21, telegram.size() - 21 - 6));
+            int const published{ rig.Sensor("1.8.0").num_published };
+            rig.Send(telegram);
+            rig.Run(1000);
+            if (rig.Sensor("1.8.0").num_published != published) ++num_published_messages;
+        }
+        // The first large message overruns the buffer
+        HOST_CHECK(num_published_messages == 7);
+        HOST_CHECK(buffer_size.state > 1600.0f);
+    }
+
+    // In replay mode, the last verified message is sent whenever the secondary port asks
+    void TestReplay()
+    {
+        Rig rig;
+        binary_sensor::BinarySensor rts;
+        rig.p1.set_secondary_rts(&rts);
+        rig.p1.set_secondary_replay(true);
+        rig.Start();
+        std::string const first{ AsciiTelegram(1) };
+        rig.Send(first);
+        rig.Run(100);
+        HOST_CHECK(rig.uart.tx.empty());
+        rts.state = true;
+        rig.Run(20);
+        HOST_CHECK(std::string(rig.uart.tx.begin(), rig.uart.tx.end()) == first);
+        rig.Run(20);
+        HOST_CHECK(rig.uart.tx.size() == first.size());
+        std::string const second{ AsciiTelegram(2) };
+        rig.Send(second);
+        rig.Run(100);
+        HOST_CHECK(rig.uart.tx.size() == first.size() + second.size());
+        rts.state = false;
+        rig.Send(AsciiTelegram(3));
+        rig.Run(100);
+        HOST_CHECK(rig.uart.tx.size() == first.size() + second.size());
+        rts.state = true;
+        rig.Run(20);
+        std::string const third{ AsciiTelegram(3) };
+        HOST_CHECK(std::string(rig.uart.tx.end() - third.size(), rig.uart.tx.end()) == third);
+    }
+
+    // Requests slow down while the power is steady, and speed up when it changes
+    void TestAdaptivePeriod()
+    {
+        Rig rig{ 1000 };
+        ReadyToReceiveTrigger ready;
+        rig.p1.register_ready_to_receive_trigger(&ready);
+        rig.p1.set_adaptive_period(16000, 0.02f, 0.01f);
+        rig.p1.add_adaptive_obis_code(Obis("1.7.0"));
+        std::vector<int> requests;
+        int now{ 0 };
+        ready.callback = [&]() {
+            // Steady power, except between 90 and 100 s
+            int const n{ now > 90000 && now < 100000 ? (now / 1000) % 2 * 25 : 0 };
+            rig.Send(AsciiTelegram(n));
+            requests.push_back(now);
+            };
+        rig.Start();
+        for (now = 0; now < 180000; now += 10) {
+            rig.p1.loop();
+            advance_clock(10);
+        }
+        auto count = [&requests](int from, int to) {
+            return std::count_if(requests.begin(), requests.end(), [&](int time) { return from <= time && time < to; });
+            };
+        // 16 s apart while steady, down to 1 s apart at the first change
+        HOST_CHECK(count(60000, 90000) <= 2);
+        HOST_CHECK(count(90000, 105000) >= 4);
+        HOST_CHECK(count(150000, 180000) <= 2);
+        HOST_CHECK(std::adjacent_find(requests.begin(), requests.end(), [](int a, int b) { return 90000 < a && b - a <= 1010; }) != requests.end());
+    }
+
+    // The snapshot has the values of the message as JSON
+    void TestSnapshot()
+    {
+        for (int individual{ 0 }; individual < 2; ++individual) {
+            Rig &rig{ *new Rig };
+            text_sensor::TextSensor snapshot;
+            rig.p1.set_snapshot_sensor(&snapshot);
+            rig.p1.set_publish_sensors(individual);
+            if (!individual) {
+                for (char const *obis_code : { "1.8.0", "1.7.0", "32.7.0" }) rig.p1.add_snapshot_obis_code(Obis(obis_code));
+            }
+            rig.Start();
+            int const published{ num_published };
+            rig.Send(AsciiTelegram(3));
+            rig.Run(300);
+            HOST_CHECK(snapshot.num_published == 1);
+            if (individual) {
+                HOST_CHECK(num_published - published == 28 + 1);
+                HOST_CHECK(snapshot.state.find("\"71.7.0\":0.6") != std::string::npos);
+            }
+            else {
+                // The sensors that are not in the snapshot are still published
+                HOST_CHECK(num_published - published == 26 - 3 + 2 + 1);
+                HOST_CHECK(rig.Sensor("32.7.0").num_published == 0);
+                HOST_CHECK(rig.Sensor("31.7.0").num_published == 1);
+                HOST_CHECK(snapshot.state == "{\"1.7.0\":0.283,\"1.8.0\":12345.003,\"32.7.0\":230.3}");
+            }
+        }
+    }
+
+    // A meter pushing a message every second, with errors in some of the messages
+    void TestResync()
+    {
+        for (int fast{ 0 }; fast < 2; ++fast) {
+            Rig &rig{ *new Rig };
+            rig.p1.set_fast_resync(fast);
+            sensor::Sensor identifying_time;
+            rig.p1.set_diagnostics_interval(100);
+            rig.p1.set_identifying_time_sensor(&identifying_time);
+            rig.Start();
+            int verified{ 0 };
+            UpdateProcessedTrigger processed;
+            processed.callback = [&verified]() { ++verified; };
+            rig.p1.register_update_processed_trigger(&processed);
+            for (int n{ 0 }; n < 12; ++n) {
+                std::string telegram{ AsciiTelegram(n, n == 3) };
+                if (n == 6) telegram = "\x13garbage" + telegram;
+                for (size_t i{ 0 }; i < telegram.size(); i += 100) {
+                    rig.Send(telegram.substr(i, 100));
+                    rig.Run(10);
+                }
+                rig.Run(1000 - 10 * static_cast<int>((telegram.size() + 99) / 100));
+            }
+            std::printf("fast_resync %d: %d of 11 good ASCII messages\n", fast, verified);
+            HOST_CHECK(verified == (fast ? 11 : 10));
+            verified = 0;
+            for (int n{ 0 }; n < 6; ++n) {
+                std::vector<uint8_t> frame{ BinaryTelegram(n) };
+                if (n == 2) frame[30] ^= 1;
+                if (n == 4) frame.insert(frame.begin(), 0x7e);
+                rig.Send(frame);
+                rig.Run(1000);
+            }
+            std::printf("fast_resync %d: %d of 5 good binary messages\n", fast, verified);
+            HOST_CHECK(verified == 5);
+            // Noise between two messages sent back to back. With fast_resync, the next message
+            // is found right after the first one, without an error.
+            verified = 0;
+            CommunicationErrorTrigger error;
+            rig.p1.register_communication_error_trigger(&error);
+            for (int n{ 0 }; n < 4; ++n) {
+                rig.Send(AsciiTelegram(2 * n) + "\x13\x11noise\r\n" + AsciiTelegram(2 * n + 1));
+                rig.Run(1000);
+            }
+            std::printf("fast_resync %d: %d of 8 good ASCII messages sent back to back, %d errors\n", fast, verified, error.count);
+            if (fast) HOST_CHECK(verified == 8 && error.count == 0);
+            // A glitch that arrives on its own, before the message, is one error. The time spent
+            // recovering is not counted as time waiting for the message.
+            error.count = 0;
+            rig.Send("\x13garbage");
+            rig.Run(300);
+            rig.Send(AsciiTelegram(8));
+            rig.Run(1000);
+            std::printf("fast_resync %d: %d errors for a glitch before a message, identifying time %.0f ms\n", fast, error.count, identifying_time.state);
+            if (fast) HOST_CHECK(verified == 9 && error.count == 1 && identifying_time.state < 100);
+        }
+    }
+
+    // Averages and peaks over three hours of messages every second at 0 to 1 kW
+    void TestAggregator()
+    {
+        Rig rig;
+        auto *const aggregator{ new P1MiniAggregator{ Obis("1.7.0"), Obis("1.8.0"), Obis("2.8.0"), 3 } };
+        sensor::Sensor average_15min, average_hour, peak, peaks_average, energy_15min, energy_hour;
+        aggregator->set_average_power_15min_sensor(&average_15min);
+        aggregator->set_average_power_hour_sensor(&average_hour);
+        aggregator->set_hourly_peak_sensor(&peak);
+        aggregator->set_hourly_peaks_average_sensor(&peaks_average);
+        aggregator->set_import_energy_15min_sensor(&energy_15min);
+        aggregator->set_import_energy_hour_sensor(&energy_hour);
+        rig.p1.set_aggregator(aggregator);
+        rig.Start();
+        for (int n{ 0 }; n < 3 * 3600; ++n) {
+            rig.Send(AsciiTelegram(n));
+            rig.Run(5);
+            advance_clock(1000 - 5);
+        }
+        std::printf("average 15 min %f, hour %f, peak %f, peaks average %f, energy 15 min %f, hour %f\n",
+            average_15min.state, average_hour.state, peak.state, peaks_average.state, energy_15min.state, energy_hour.state);
+        HOST_CHECK(average_15min.has_state() && average_hour.has_state() && peak.has_state());
+        HOST_CHECK(0.45f < average_hour.state && average_hour.state < 0.55f);
+        HOST_CHECK(average_hour.state <= peak.state && peak.state < 0.55f);
+        HOST_CHECK(peaks_average.has_state() && peaks_average.state <= peak.state + 0.01f);
+    }
+
+    // No energy is published for the quarters around a gap in the messages
+    void TestAggregatorGap()
+    {
+        Rig rig;
+        auto *const aggregator{ new P1MiniAggregator{ Obis("1.7.0"), Obis("1.8.0"), Obis("2.8.0"), 3 } };
+        sensor::Sensor energy_15min, energy_hour;
+        aggregator->set_import_energy_15min_sensor(&energy_15min);
+        aggregator->set_import_energy_hour_sensor(&energy_hour);
+        rig.p1.set_aggregator(aggregator);
+        rig.Start();
+        // One message per second, with 1.8.0 going up by 0.001 kWh in each, and none for
+        // 20 minutes in the second hour
+        std::vector<int> quarters;
+        for (int n{ 0 }; n < 3 * 3600; ++n) {
+            int const published{ energy_15min.num_published };
+            if (n < 70 * 60 || 90 * 60 <= n) {
+                rig.Send(AsciiTelegram(n));
+                rig.Run(5);
+                advance_clock(1000 - 5);
+            }
+            else advance_clock(1000);
+            if (energy_15min.num_published == published) continue;
+            HOST_CHECK(0.899f < energy_15min.state && energy_15min.state < 0.901f);
+            quarters.push_back(millis() / (15 * 60000));
+        }
+        // Not the first quarter, nor the ones the gap ran into and the one after it. The hour
+        // with the gap is still reported, as its start and end were received.
+        HOST_CHECK((quarters == std::vector<int>{ 2, 3, 4, 8, 9, 10, 11, 12 }));
+        HOST_CHECK(energy_hour.num_published == 2 && 3.599f < energy_hour.state && energy_hour.state < 3.601f);
+    }
+
+    // Two meters controlled by RTS take turns, each sending one byte per ms once asked to
+    void TestMultipleMeters()
+    {
+        struct Meter {
+            uart::UARTComponent uart;
+            P1Mini *p1;
+            ReadyToReceiveTrigger ready;
+            std::string pending;
+            int num_requests{ 0 };
+        };
+        Meter meters[2];
+        for (Meter &meter : meters) {
+            meter.p1 = new P1Mini{ 2000, 3072 };
+            meter.p1->set_uart_parent(&meter.uart);
+            meter.p1->register_sensor(new P1MiniSensor{ Obis("1.7.0") });
+            meter.p1->register_ready_to_receive_trigger(&meter.ready);
+        }
+        for (Meter &meter : meters) meter.p1->setup();
+        int overlapping{ 0 };
+        for (int now{ 0 }; now < 30000; ++now) {
+            int num_sending{ 0 };
+            for (Meter &meter : meters) {
+                if (meter.ready.count != meter.num_requests) {
+                    meter.num_requests = meter.ready.count;
+                    meter.pending = AsciiTelegram(now);
+                }
+                if (!meter.pending.empty()) {
+                    meter.uart.push(meter.pending.substr(0, 1));
+                    meter.pending.erase(0, 1);
+                    ++num_sending;
+                }
+                meter.p1->loop();
+            }
+            if (num_sending == 2) ++overlapping;
+            advance_clock(1);
+        }
+        std::printf("requests %d and %d, %d ms with both meters sending\n", meters[0].num_requests, meters[1].num_requests, overlapping);
+        HOST_CHECK(meters[0].num_requests >= 10 && meters[1].num_requests >= 10);
+        HOST_CHECK(overlapping == 0);
+    }
+
+    // The diagnostics are published on a timer, in any state, and are those of the last
+    // complete cycle, not of the one in progress or one that ended with an error.
+    void TestDiagnostics()
+    {
+        Rig rig;
+        sensor::Sensor identifying_time, message_time, processing_time, publishing_time, message_size;
+        rig.p1.set_diagnostics_interval(700);
+        rig.p1.set_identifying_time_sensor(&identifying_time);
+        rig.p1.set_message_time_sensor(&message_time);
+        rig.p1.set_processing_time_sensor(&processing_time);
+        rig.p1.set_publishing_time_sensor(&publishing_time);
+        rig.p1.set_message_size_sensor(&message_size);
+        rig.Start();
+        int num_checked{ 0 };
+        auto run = [&](int ms) {
+            for (int i{ 0 }; i < ms; ++i) {
+                int const published{ publishing_time.num_published };
+                rig.Run(1);
+                if (publishing_time.num_published == published) continue;
+                HOST_CHECK(identifying_time.state < 2000 && message_time.state < 100);
+                HOST_CHECK(processing_time.state < 100 && publishing_time.state < 100);
+                HOST_CHECK(message_size.state == AsciiTelegram(0).size());
+                ++num_checked;
+            }
+            };
+        for (int n{ 0 }; n < 10; ++n) {
+            std::string const telegram{ AsciiTelegram(n) };
+            rig.Send(telegram);
+            run(300);
+            rig.Send(AsciiTelegram(n, true));
+            run(1200);
+            // Part of a message, for the diagnostics published while it is identified and read
+            rig.Send(telegram.substr(0, 100));
+            run(50);
+            rig.Send(telegram.substr(100));
+            run(450);
+        }
+        std::printf("%d diagnostics checked\n", num_checked);
+        HOST_CHECK(num_checked >= 10);
+    }
+
+    struct Test {
+        char const *name;
+        void (*run)();
+    };
+    Test const tests[]{
+        { "corpus", TestCorpus },
+        { "ascii_chunks", TestAsciiChunks },
+        { "obis_range", TestObisRange },
+        { "prediction", TestPrediction },
+        { "bad_crc", TestBadCrc },
+        { "streaming", TestStreaming },
+        { "binary", TestBinary },
+        { "binary_large_value", TestBinaryLargeValue },
+        { "back_to_back", TestBackToBack },
+        { "publish_policy", TestPublishPolicy },
+        { "auto_buffer", TestAutoBuffer },
+        { "replay", TestReplay },
+        { "adaptive_period", TestAdaptivePeriod },
+        { "snapshot", TestSnapshot },
+        { "resync", TestResync },
+        { "aggregator", TestAggregator },
+        { "aggregator_gap", TestAggregatorGap },
+        { "multiple_meters", TestMultipleMeters },
+        { "diagnostics", TestDiagnostics },
+    };
+
+}
+
+int main(int argc, char **argv)
+{
+    for (Test const &test : tests) {
+        if (argc == 1) std::printf("%s\n", test.name);
+        else if (std::strcmp(argv[1], test.name) == 0) {
+            test.run();
+            std::printf("%s passed\n", test.name);
+            return 0;
+        }
+    }
+    if (argc == 1) return 0;
+    std::printf("Unknown test %s\n", argv[1]);
+    return 1;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+namespace esphome {
+    namespace binary_sensor {
+
+        class BinarySensor {
+        public:
+            bool state{ false };
+        };
+
+    } // namespace binary_sensor
+} // namespace esphome
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "host_stubs.h"
+
+namespace esphome {
+    namespace network {
+
+        // Set by the test, up by default
+        inline bool is_connected() { return host::network_connected; }
+
+    } // namespace network
+} // namespace esphome
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "host_stubs.h"
+
+#include <string>
+
+namespace esphome {
+    namespace sensor {
+
+        class Sensor {
+        public:
+            void publish_state(float state)
+            {
+                this->state = state;
+                m_has_state = true;
+                ++num_published;
+                ++host::num_published;
+            }
+            bool has_state() const { return m_has_state; }
+
+            float state{ 0.0f };
+            int num_published{ 0 };
+
+        private:
+            bool m_has_state{ false };
+        };
+
+    } // namespace sensor
+} // namespace esphome
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace esphome {
+    namespace socket {
+
+        // The BSD sockets of the host, with the interface of the ESPHome socket component
+        class Socket {
+        public:
+            explicit Socket(int fd) : m_fd{ fd } {}
+            ~Socket()
+            {
+                if (m_fd >= 0) ::close(m_fd);
+            }
+
+            std::unique_ptr<Socket> accept(struct sockaddr *address, socklen_t *length)
+            {
+                int const fd{ ::accept(m_fd, address, length) };
+                if (fd < 0) return nullptr;
+                // lwIP sends from a buffer of a few KB (TCP_SND_BUF), where Linux would grow it
+                // to megabytes for a client that does not read
+                int const send_buffer_size{ 8192 };
+                ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer_size, sizeof(send_buffer_size));
+                return std::unique_ptr<Socket>{ new Socket{ fd } };
+            }
+            int bind(struct sockaddr const *address, socklen_t length) { return ::bind(m_fd, address, length); }
+            int close()
+            {
+                int const result{ ::close(m_fd) };
+                m_fd = -1;
+                return result;
+            }
+            int listen(int backlog) { return ::listen(m_fd, backlog); }
+            ssize_t read(void *buffer, size_t length) { return ::read(m_fd, buffer, length); }
+            ssize_t write(void const *buffer, size_t length) { return ::send(m_fd, buffer, length, MSG_NOSIGNAL); }
+            int setsockopt(int level, int name, void const *value, socklen_t length) { return ::setsockopt(m_fd, level, name, value, length); }
+            int setblocking(bool blocking)
+            {
+                int const flags{ fcntl(m_fd, F_GETFL) };
+                return fcntl(m_fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+            }
+
+        private:
+            int m_fd;
+        };
+
+        inline std::unique_ptr<Socket> socket_ip(int type, int protocol)
+        {
+            int const fd{ ::socket(AF_INET, type, protocol) };
+            if (fd < 0) return nullptr;
+            return std::unique_ptr<Socket>{ new Socket{ fd } };
+        }
+
+        inline socklen_t set_sockaddr_any(struct sockaddr *address, socklen_t, uint16_t port)
+        {
+            auto *const in{ reinterpret_cast<struct sockaddr_in *>(address) };
+            std::memset(in, 0, sizeof(*in));
+            in->sin_family = AF_INET;
+            in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            in->sin_port = htons(port);
+            return sizeof(*in);
+        }
+
+    } // namespace socket
+} // namespace esphome
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "host_stubs.h"
+
+#include <string>
+
+namespace esphome {
+    namespace text_sensor {
+
+        class TextSensor {
+        public:
+            void publish_state(std::string const &state)
+            {
+                this->state = state;
+                m_has_state = true;
+                ++num_published;
+                ++host::num_published;
+            }
+            bool has_state() const { return m_has_state; }
+
+            std::string state;
+            int num_published{ 0 };
+
+        private:
+            bool m_has_state{ false };
+        };
+
+    } // namespace text_sensor
+} // namespace esphome
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+    namespace uart {
+
+        // The receive side is filled by the test, or by a simulated meter, and may be read
+        // from another thread by the reader task.
+        class UARTComponent {
+        public:
+            void push(uint8_t const *data, size_t length)
+            {
+                std::lock_guard<std::mutex> lock{ m_lock };
+                m_rx.insert(m_rx.end(), data, data + length);
+            }
+            void push(std::string const &data) { push(reinterpret_cast<uint8_t const *>(data.data()), data.size()); }
+            void push(std::vector<uint8_t> const &data) { push(data.data(), data.size()); }
+
+            int available()
+            {
+                std::lock_guard<std::mutex> lock{ m_lock };
+                return static_cast<int>(m_rx.size());
+            }
+            bool read_array(uint8_t *data, size_t length)
+            {
+                std::lock_guard<std::mutex> lock{ m_lock };
+                if (m_rx.size() < length) return false;
+                std::copy(m_rx.begin(), m_rx.begin() + length, data);
+                m_rx.erase(m_rx.begin(), m_rx.begin() + length);
+                num_read += length;
+                return true;
+            }
+            void write_array(uint8_t const *data, size_t length) { tx.insert(tx.end(), data, data + length); }
+
+            // Everything written by the component, to the secondary port
+            std::vector<uint8_t> tx;
+            // Bytes read by the component since the start
+            size_t num_read{ 0 };
+
+        private:
+            std::mutex m_lock;
+            std::deque<uint8_t> m_rx;
+        };
+
+        class UARTDevice {
+        public:
+            void set_uart_parent(UARTComponent *parent) { this->parent_ = parent; }
+
+            int available() { return this->parent_->available(); }
+            int read()
+            {
+                uint8_t data;
+                return this->parent_->read_array(&data, 1) ? data : -1;
+            }
+            bool read_array(uint8_t *data, size_t length) { return this->parent_->read_array(data, length); }
+            void write(uint8_t data) { this->parent_->write_array(&data, 1); }
+            void write_array(uint8_t const *data, size_t length) { this->parent_->write_array(data, length); }
+            void flush() {}
+
+        protected:
+            UARTComponent *parent_{ nullptr };
+        };
+
+    } // namespace uart
+} // namespace esphome
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+#include <map>
+#include <string>
+
+// Requests are made directly by the test, and the response is kept in the request
+
+enum WebRequestMethod { HTTP_GET = 1, HTTP_POST = 2 };
+
+class AsyncWebParameter {
+public:
+    explicit AsyncWebParameter(std::string value = {}) : m_value{ std::move(value) } {}
+    std::string const &value() const { return m_value; }
+
+private:
+    std::string m_value;
+};
+
+class AsyncResponseStream {
+public:
+    size_t printf(char const *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char text[512];
+        va_list args;
+        va_start(args, format);
+        int const length{ vsnprintf(text, sizeof(text), format, args) };
+        va_end(args);
+        body += text;
+        return length;
+    }
+
+    std::string content_type;
+    std::string body;
+};
+
+class AsyncWebServerRequest {
+public:
+    AsyncWebServerRequest(std::string url, std::map<std::string, std::string> params = {}) : m_url{ std::move(url) }
+    {
+        for (auto const &param : params) m_params.emplace(param.first, AsyncWebParameter{ param.second });
+    }
+
+    int method() const { return HTTP_GET; }
+    std::string url() const { return m_url; }
+    bool hasParam(char const *name) const { return m_params.count(name) != 0; }
+    AsyncWebParameter *getParam(char const *name)
+    {
+        auto const param{ m_params.find(name) };
+        return param == m_params.end() ? nullptr : &param->second;
+    }
+
+    AsyncResponseStream *beginResponseStream(char const *content_type)
+    {
+        m_stream.content_type = content_type;
+        return &m_stream;
+    }
+    void send(AsyncResponseStream *stream) { response = stream->body; }
+
+    std::string response;
+
+private:
+    std::string m_url;
+    std::map<std::string, AsyncWebParameter> m_params;
+    AsyncResponseStream m_stream;
+};
+
+class AsyncWebHandler {
+public:
+    virtual ~AsyncWebHandler() = default;
+    virtual bool canHandle(AsyncWebServerRequest *request) { return false; }
+    virtual void handleRequest(AsyncWebServerRequest *request) {}
+};
+
+namespace esphome {
+    namespace web_server_base {
+
+        class WebServerBase {
+        public:
+            void init() {}
+            void add_handler(AsyncWebHandler *handler) { this->handler = handler; }
+
+            AsyncWebHandler *handler{ nullptr };
+        };
+
+    } // namespace web_server_base
+} // namespace esphome
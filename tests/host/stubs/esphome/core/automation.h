@@ -0,0 +1,20 @@
+#pragma once
+
+#include <functional>
+
+namespace esphome {
+
+    // Instead of running automations, a trigger counts and calls back into the test
+    template<typename... Ts> class Trigger {
+    public:
+        void trigger(Ts... x)
+        {
+            ++count;
+            if (callback) callback(x...);
+        }
+
+        int count{ 0 };
+        std::function<void(Ts...)> callback;
+    };
+
+} // namespace esphome
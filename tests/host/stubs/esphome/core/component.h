@@ -0,0 +1,32 @@
+#pragma once
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include <cmath>
+
+namespace esphome {
+
+    namespace setup_priority {
+        constexpr float DATA{ 600.0f };
+        constexpr float AFTER_WIFI{ 250.0f };
+        constexpr float LATE{ -100.0f };
+    }
+
+    class Component {
+    public:
+        virtual ~Component() = default;
+        virtual void setup() {}
+        virtual void loop() {}
+        virtual void dump_config() {}
+        virtual float get_setup_priority() const { return 0.0f; }
+
+        void mark_failed() { m_failed = true; }
+        bool is_failed() const { return m_failed; }
+
+    private:
+        bool m_failed{ false };
+    };
+
+} // namespace esphome
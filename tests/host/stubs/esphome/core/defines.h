@@ -0,0 +1,3 @@
+#pragma once
+
+// The optional features are enabled by the build of each test, see CMakeLists.txt
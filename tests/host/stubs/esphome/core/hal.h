@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+
+    // Provided by the host clock, see host.h
+    uint32_t millis();
+    uint32_t micros();
+
+} // namespace esphome
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+
+    // Same interface as in ESPHome, where it is a no-op on single threaded platforms
+    class Mutex {
+    public:
+        void lock() { m_mutex.lock(); }
+        bool try_lock() { return m_mutex.try_lock(); }
+        void unlock() { m_mutex.unlock(); }
+
+    private:
+        std::mutex m_mutex;
+    };
+
+    class LockGuard {
+    public:
+        LockGuard(Mutex &mutex) : m_mutex{ mutex } { m_mutex.lock(); }
+        ~LockGuard() { m_mutex.unlock(); }
+
+    private:
+        Mutex &m_mutex;
+    };
+
+} // namespace esphome
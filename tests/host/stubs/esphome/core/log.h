@@ -0,0 +1,30 @@
+#pragma once
+
+#include <functional>
+
+namespace esphome {
+    namespace host {
+
+        enum log_levels { LOG_NONE, LOG_ERROR, LOG_WARN, LOG_INFO, LOG_CONFIG, LOG_DEBUG, LOG_VERBOSE, NUM_LOG_LEVELS };
+
+        // Messages above this level are counted, but not printed
+        extern int log_level;
+        extern int log_counts[NUM_LOG_LEVELS];
+        // Called with each message at any level, for the tests that check what is logged
+        extern std::function<void(int level, char const *message)> log_callback;
+
+        void log(int level, char const *tag, char const *format, ...) __attribute__((format(printf, 3, 4)));
+
+    } // namespace host
+} // namespace esphome
+
+#define ESP_LOGE(tag, ...) ::esphome::host::log(::esphome::host::LOG_ERROR, tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ::esphome::host::log(::esphome::host::LOG_WARN, tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ::esphome::host::log(::esphome::host::LOG_INFO, tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) ::esphome::host::log(::esphome::host::LOG_CONFIG, tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) ::esphome::host::log(::esphome::host::LOG_DEBUG, tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) ::esphome::host::log(::esphome::host::LOG_VERBOSE, tag, __VA_ARGS__)
+#define LOG_SENSOR(prefix, type, sensor) \
+    if ((sensor) != nullptr) ESP_LOGCONFIG("sensor", "%s%s", prefix, type)
+#define LOG_TEXT_SENSOR(prefix, type, sensor) \
+    if ((sensor) != nullptr) ESP_LOGCONFIG("text_sensor", "%s%s", prefix, type)
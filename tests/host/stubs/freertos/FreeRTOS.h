@@ -0,0 +1,3 @@
+#pragma once
+
+#define pdPASS 1
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+// Tasks are threads that are never joined, as tasks are never deleted
+inline int xTaskCreate(void (*function)(void *), char const *, int, void *parameter, int, void *)
+{
+    std::thread(function, parameter).detach();
+    return pdPASS;
+}
+
+inline void vTaskDelay(int ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
@@ -0,0 +1,78 @@
+#include "host_stubs.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+
+namespace esphome {
+    namespace host {
+
+        namespace {
+            // Starts away from 0, like on the device, where setup() runs some time after boot
+            std::atomic<uint32_t> s_simulated_ms{ 1000 };
+            bool s_real_clock{ false };
+            // The real clock continues from the simulated time when it was switched to
+            std::chrono::steady_clock::time_point s_real_start;
+
+            uint64_t RealMicros()
+            {
+                return s_simulated_ms * uint64_t{ 1000 } + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_real_start).count();
+            }
+        }
+
+        int num_published{ 0 };
+        bool network_connected{ true };
+        std::atomic<uint32_t> num_millis_calls{ 0 };
+        int log_level{ LOG_WARN };
+        int log_counts[NUM_LOG_LEVELS]{};
+        std::function<void(int level, char const *message)> log_callback;
+
+        void use_real_clock(bool real)
+        {
+            if (real == s_real_clock) return;
+            if (real) s_real_start = std::chrono::steady_clock::now();
+            else s_simulated_ms = static_cast<uint32_t>(RealMicros() / 1000);
+            s_real_clock = real;
+        }
+        void advance_clock(uint32_t ms) { s_simulated_ms += ms; }
+
+        void log(int level, char const *tag, char const *format, ...)
+        {
+            ++log_counts[level];
+            if (log_callback) {
+                char message[1024];
+                va_list args;
+                va_start(args, format);
+                std::vsnprintf(message, sizeof(message), format, args);
+                va_end(args);
+                log_callback(level, message);
+            }
+            if (level > log_level) return;
+            static char const levels[]{ " EWICDV" };
+            std::printf("[%c][%s] ", levels[level], tag);
+            va_list args;
+            va_start(args, format);
+            std::vprintf(format, args);
+            va_end(args);
+            std::printf("\n");
+        }
+
+    } // namespace host
+
+    uint32_t micros()
+    {
+        if (!host::s_real_clock) return host::s_simulated_ms * 1000;
+        return static_cast<uint32_t>(host::RealMicros());
+    }
+
+    uint32_t millis()
+    {
+        host::num_millis_calls.fetch_add(1, std::memory_order_relaxed);
+        if (!host::s_real_clock) return host::s_simulated_ms;
+        return static_cast<uint32_t>(host::RealMicros() / 1000);
+    }
+
+} // namespace esphome
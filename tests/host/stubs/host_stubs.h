@@ -0,0 +1,23 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace esphome {
+    namespace host {
+
+        // millis() and micros() follow a simulated clock, which only moves when the test
+        // advances it, or the real clock for benchmarks.
+        void use_real_clock(bool real);
+        void advance_clock(uint32_t ms);
+
+        // By all sensors and text sensors together
+        extern int num_published;
+        // What network::is_connected() returns
+        extern bool network_connected;
+        // Calls to millis(). The processing states read the clock after every line or data
+        // element, so this counts their steps independently of the speed of the host.
+        extern std::atomic<uint32_t> num_millis_calls;
+
+    } // namespace host
+} // namespace esphome